@@ -54,8 +54,10 @@ fn main() {
             Path::new(&dir).join("libtexpdf").join(".libs").display()
         );
         println!("cargo:rustc-link-arg=-l:fontmetrics.a");
+        println!("cargo:rustc-link-arg=-l:justenoughbreak.a");
         println!("cargo:rustc-link-arg=-l:justenoughfontconfig.a");
         println!("cargo:rustc-link-arg=-l:justenoughharfbuzz.a");
+        println!("cargo:rustc-link-arg=-l:justenoughhyphen.a");
         println!("cargo:rustc-link-arg=-l:justenoughicu.a");
         println!("cargo:rustc-link-arg=-l:justenoughlibtexpdf.a");
         println!("cargo:rustc-link-arg=-l:svg.a");
@@ -67,8 +69,9 @@ fn main() {
         println!("cargo:rustc-link-arg=-lharfbuzz-subset"); // needed by justenoughharfbuzz
         println!("cargo:rustc-link-arg=-lfontconfig"); // needed by justenoughfontconfig
         println!("cargo:rustc-link-arg=-licui18n"); // needed by justenoughicu
-        println!("cargo:rustc-link-arg=-licuuc"); // needed by justenoughicu
-        println!("cargo:rustc-link-arg=-lm"); // needed by svg
+        println!("cargo:rustc-link-arg=-licuuc"); // needed by justenoughicu and justenoughharfbuzz
+        println!("cargo:rustc-link-arg=-lm"); // needed by svg and justenoughbreak
+        println!("cargo:rustc-link-arg=-lpthread"); // needed by justenoughbreak
         println!("cargo:rustc-link-arg=-lz"); // needed by libtexpdf
         println!("cargo:rustc-link-arg=-lpng"); // needed by libtexpdf
     }
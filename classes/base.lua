@@ -658,6 +658,7 @@ function class:initialFrame ()
       SILE.documentState.thisPageTemplate.firstContentFrame = SILE.frames[self.firstContentFrame]
    end
    SILE.documentState.thisPageTemplate.firstContentFrame:invalidate()
+   SILE.layoutFrames()
    return SILE.documentState.thisPageTemplate.firstContentFrame
 end
 
@@ -22,6 +22,42 @@ SILE.settings:declare({ parameter = "linebreak.linePenalty", type = "integer", d
 SILE.settings:declare({ parameter = "linebreak.hyphenPenalty", type = "integer", default = 50 })
 SILE.settings:declare({ parameter = "linebreak.doubleHyphenDemerits", type = "integer", default = 10000 })
 SILE.settings:declare({ parameter = "linebreak.finalHyphenDemerits", type = "integer", default = 5000 })
+SILE.settings:declare({
+   parameter = "linebreak.native",
+   type = "boolean",
+   default = true,
+   help = "If set to true, paragraphs without alternatives or paragraph shapes are broken by the native line breaker.",
+})
+SILE.settings:declare({
+   parameter = "linebreak.threads",
+   type = "integer",
+   default = 1,
+   help = "Number of native threads on which the native line breaker may run the second and emergency passes side by side",
+})
+SILE.settings:declare({
+   parameter = "linebreak.lazyHyphenation",
+   type = "boolean",
+   default = false,
+   help = "If set to true, when a paragraph needs hyphenating the second pass only hyphenates from shortly before the point where the first pass failed",
+})
+SILE.settings:declare({
+   parameter = "linebreak.windowSize",
+   type = "integer",
+   default = 0,
+   help = "If positive, paragraphs of more nodes than this are scanned this many nodes at a time, with the lines ending more than this many nodes back committed",
+})
+SILE.settings:declare({
+   parameter = "linebreak.memoSize",
+   type = "integer",
+   default = 0,
+   help = "Maximum number of paragraphs whose breaks are memoized, 0 (the default) to disable the memo",
+})
+SILE.settings:declare({
+   parameter = "linebreak.persistMemo",
+   type = "boolean",
+   default = false,
+   help = "If set to true, memoized paragraph breaks are kept between runs in a .breaks file next to the input (needs linebreak.memoSize)",
+})
 
 -- doubleHyphenDemerits
 -- hyphenPenalty
@@ -33,6 +69,13 @@ local inf_bad = 10000
 local ejectPenalty = -inf_bad
 local lineBreak = {}
 
+local has_native, nativeBreaker = pcall(require, "justenoughbreak")
+
+-- Node kinds and record strides understood by justenoughbreak.knuthplass
+local kinds = { box = 0, glue = 1, kern = 2, discretionary = 3, penalty = 4, other = 5 }
+local recordStride = 8
+local discretionaryStride = 9
+
 --[[
   Basic control flow:
   doBreak:
@@ -57,15 +100,15 @@ end
 local debugging = false
 
 function lineBreak:init ()
-   self:trimGlue() -- 842
    -- 849
-   self.activeWidth = SILE.types.length()
-   self.curActiveWidth = SILE.types.length()
-   self.breakWidth = SILE.types.length()
+   -- The widths summed in the inner loops are packed lengths, updated in place
+   self.activeWidth = SILE.types.packedlength()
+   self.curActiveWidth = SILE.types.packedlength()
+   self.breakWidth = SILE.types.packedlength()
    -- 853
-   local rskip = (SILE.settings:get("document.rskip") or SILE.types.node.glue()).width:absolute()
-   local lskip = (SILE.settings:get("document.lskip") or SILE.types.node.glue()).width:absolute()
-   self.background = rskip + lskip
+   local rskip = (SILE.settings:get("document.rskip") or SILE.types.node.glue()).width
+   local lskip = (SILE.settings:get("document.lskip") or SILE.types.node.glue()).width
+   self.background = SILE.types.packedlength(rskip):add(lskip)
    -- 860
    self.bestInClass = {}
    for i = 1, #classes do
@@ -125,6 +168,9 @@ end
 
 -- Wrap linebreak:parShape in a memoized table for fast access
 function lineBreak:parShapeCache (n)
+   if n > self.parShapeLines then
+      self.parShapeLines = n
+   end
    local cache = parShapeCache[n]
    if not cache then
       local l, w, r = self:parShape(n)
@@ -148,15 +194,16 @@ function lineBreak:setupLineLengths () -- 874
       self.hangIndent = param("hangIndent"):tonumber()
       if self.hangIndent == 0 then
          self.lastSpecialLine = 0
-         self.secondWidth = self.hsize or SU.error("No hsize")
+         self.secondWidth = SU.cast("number", self.hsize or SU.error("No hsize"))
       else -- 875
+         local hsize = SU.cast("number", self.hsize or SU.error("No hsize"))
          self.lastSpecialLine = math.abs(self.hangAfter)
          if self.hangAfter < 0 then
-            self.secondWidth = self.hsize or SU.error("No hsize")
-            self.firstWidth = self.hsize - math.abs(self.hangIndent)
+            self.secondWidth = hsize
+            self.firstWidth = hsize - math.abs(self.hangIndent)
          else
-            self.firstWidth = self.hsize or SU.error("No hsize")
-            self.secondWidth = self.hsize - math.abs(self.hangIndent)
+            self.firstWidth = hsize
+            self.secondWidth = hsize - math.abs(self.hangIndent)
          end
       end
       if param("looseness") == 0 then
@@ -189,7 +236,7 @@ function lineBreak:tryBreak () -- 855
    self.prev_r = self.activeListHead
    self.old_l = 0
    self.r = nil
-   self.curActiveWidth = SILE.types.length(self.activeWidth)
+   self.curActiveWidth:set(self.activeWidth)
    while true do
       while true do -- allows "break" to function as "continue"
          self.r = self.prev_r.next
@@ -204,7 +251,7 @@ function lineBreak:tryBreak () -- 855
             if debugging then
                SU.debug("break", " Adding delta node width of", self.r.width)
             end
-            self.curActiveWidth:___add(self.r.width)
+            self.curActiveWidth:add(self.r.width)
             self.prev_prev_r = self.prev_r
             self.prev_r = self.r
             break
@@ -232,8 +279,8 @@ function lineBreak:tryBreak () -- 855
                if self.lastSpecialLine and self.r.lineNumber > self.lastSpecialLine then
                   self.lineWidth = self.secondWidth
                elseif self.parShaping then
-                  local _
-                  _, self.lineWidth, _ = self:parShapeCache(self.r.lineNumber)
+                  local _, width = self:parShapeCache(self.r.lineNumber)
+                  self.lineWidth = SU.cast("number", width)
                else
                   self.lineWidth = self.firstWidth
                end
@@ -255,14 +302,12 @@ function lineBreak:tryBreak () -- 855
    end
 end
 
--- Note: This function gets called a lot and to optimize it we're assuming that
--- the lengths being passed are already absolutized. This is not a safe
--- assumption to make universally.
+-- Note: This function gets called a lot, so it works on the plain numbers of
+-- the packed current active width and a shortfall in points.
 local function fitclass (self, shortfall)
-   shortfall = shortfall.amount
    local badness, class
-   local stretch = self.curActiveWidth.stretch.amount
-   local shrink = self.curActiveWidth.shrink.amount
+   local stretch = self.curActiveWidth.stretch
+   local shrink = self.curActiveWidth.shrink
    if shortfall > 0 then
       if shortfall > 110 and stretch < 25 then
          badness = inf_bad
@@ -306,7 +351,7 @@ function lineBreak:tryAlternatives (from, to)
    end
    local localMinimum = awful_bad
    -- local selectedShortfall
-   local shortfall = self.lineWidth - self.curActiveWidth
+   local shortfall = self.lineWidth - self.curActiveWidth.length
    if debugging then
       SU.debug("break", "Shortfall was ", shortfall)
    end
@@ -319,10 +364,8 @@ function lineBreak:tryAlternatives (from, to)
             SU.debug("break", alternative.options[combination[i]], " width", addWidth)
          end
       end
-      local ss = shortfall - addWidth
-      -- Warning, assumes abosolute
-      local badness =
-         SU.rateBadness(inf_bad, ss.length.amount, self.curActiveWidth[ss > 0 and "stretch" or "shrink"].length.amount)
+      local ss = shortfall - SU.cast("number", addWidth)
+      local badness = SU.rateBadness(inf_bad, ss, self.curActiveWidth[ss > 0 and "stretch" or "shrink"])
       if debugging then
          SU.debug("break", "  badness of", ss, "(", self.curActiveWidth, ") is", badness)
       end
@@ -336,8 +379,8 @@ function lineBreak:tryAlternatives (from, to)
    if debugging then
       SU.debug("break", "Choosing ", alternates[1].options[self.r.altSelections[1]])
    end
-   -- self.curActiveWidth:___add(selectedShortfall)
-   shortfall = self.lineWidth - self.curActiveWidth
+   -- self.curActiveWidth:add(selectedShortfall)
+   shortfall = self.lineWidth - self.curActiveWidth.length
    if debugging then
       SU.debug("break", "Is now ", shortfall)
    end
@@ -353,7 +396,7 @@ function lineBreak:considerDemerits (pi, breakType) -- 877
          self.r.curBreak and self.r.curBreak or 1
       )
    end
-   local shortfall = self.lineWidth - self.curActiveWidth
+   local shortfall = self.lineWidth - self.curActiveWidth.length
    self.badness, self.fitClass = fitclass(self, shortfall)
    if debugging then
       SU.debug("break", self.badness, self.fitClass)
@@ -380,13 +423,8 @@ function lineBreak:considerDemerits (pi, breakType) -- 877
       nodeStaysActive = true
    end
 
-   local _shortfall = shortfall:tonumber()
-   local function shortfallratio (metric)
-      local prop = self.curActiveWidth[metric]:tonumber()
-      local factor = prop ~= 0 and prop or awful_bad
-      return _shortfall / factor
-   end
-   self.lastRatio = shortfallratio(_shortfall > 0 and "stretch" or "shrink")
+   local prop = shortfall > 0 and self.curActiveWidth.stretch or self.curActiveWidth.shrink
+   self.lastRatio = shortfall / (prop ~= 0 and prop or awful_bad)
    self:recordFeasible(pi, breakType)
    if not nodeStaysActive then
       self:deactivateR()
@@ -402,8 +440,8 @@ function lineBreak:deactivateR () -- 886
       -- 887
       self.r = self.activeListHead.next
       if self.r.type == "delta" then
-         self.activeWidth:___add(self.r.width)
-         self.curActiveWidth = SILE.types.length(self.activeWidth)
+         self.activeWidth:add(self.r.width)
+         self.curActiveWidth:set(self.activeWidth)
          self.activeListHead.next = self.r.next
       end
       if debugging then
@@ -413,15 +451,15 @@ function lineBreak:deactivateR () -- 886
       if self.prev_r.type == "delta" then
          self.r = self.prev_r.next
          if self.r == self.activeListHead then
-            self.curActiveWidth:___sub(self.prev_r.width)
+            self.curActiveWidth:sub(self.prev_r.width)
             -- FIXME It was crashing here, so changed from:
             -- self.curActiveWidth:___sub(self.r.width)
             -- But I'm not so sure reading Knuth here...
             self.prev_prev_r.next = self.activeListHead
             self.prev_r = self.prev_prev_r
          elseif self.r.type == "delta" then
-            self.curActiveWidth:___add(self.r.width)
-            self.prev_r.width:___add(self.r.width)
+            self.curActiveWidth:add(self.r.width)
+            self.prev_r.width:add(self.r.width)
             self.prev_r.next = self.r.next
          end
       end
@@ -497,20 +535,20 @@ function lineBreak:createNewActiveNodes (breakType) -- 862
    if self.no_break_yet then
       -- 863
       self.no_break_yet = false
-      self.breakWidth = SILE.types.length(self.background)
+      self.breakWidth:set(self.background)
       local place = self.place
       local node = self.nodes[place]
       if node and node.is_discretionary then -- 866
-         self.breakWidth:___add(node:prebreakWidth())
-         self.breakWidth:___add(node:postbreakWidth())
-         self.breakWidth:___sub(node:replacementWidth())
+         self.breakWidth:add(node:prebreakWidth())
+         self.breakWidth:add(node:postbreakWidth())
+         self.breakWidth:sub(node:replacementWidth())
       end
       while self.nodes[place] and not self.nodes[place].is_box do
          if self.sideways and self.nodes[place].height then
-            self.breakWidth:___sub(self.nodes[place].height)
-            self.breakWidth:___sub(self.nodes[place].depth)
+            self.breakWidth:sub(self.nodes[place].height)
+            self.breakWidth:sub(self.nodes[place].depth)
          elseif self.nodes[place].width then -- We use the fact that (a) nodes know if they have width and (b) width subtraction is polymorphic
-            self.breakWidth:___sub(self.nodes[place]:lineContribution())
+            self.breakWidth:sub(self.nodes[place]:lineContribution())
          end
          place = place + 1
       end
@@ -520,12 +558,12 @@ function lineBreak:createNewActiveNodes (breakType) -- 862
    end
    -- 869 (Add a new delta node)
    if self.prev_r.type == "delta" then
-      self.prev_r.width:___sub(self.curActiveWidth)
-      self.prev_r.width:___add(self.breakWidth)
+      self.prev_r.width:sub(self.curActiveWidth)
+      self.prev_r.width:add(self.breakWidth)
    elseif self.prev_r == self.activeListHead then
-      self.activeWidth = SILE.types.length(self.breakWidth)
+      self.activeWidth:set(self.breakWidth)
    else
-      local newDelta = { next = self.r, type = "delta", width = self.breakWidth - self.curActiveWidth }
+      local newDelta = { next = self.r, type = "delta", width = self.breakWidth:copy():sub(self.curActiveWidth) }
       if debugging then
          SU.debug("break", "Added new delta node =", newDelta.width)
       end
@@ -573,7 +611,7 @@ function lineBreak:createNewActiveNodes (breakType) -- 862
    self.minimumDemerits = awful_bad
    -- 870
    if self.r ~= self.activeListHead then
-      local newDelta = { next = self.r, type = "delta", width = self.curActiveWidth - self.breakWidth }
+      local newDelta = { next = self.r, type = "delta", width = self.curActiveWidth:copy():sub(self.breakWidth) }
       self.prev_r.next = newDelta
       self.prev_prev_r = self.prev_r
       self.prev_r = newDelta
@@ -593,7 +631,7 @@ function lineBreak:describeBreakNode (node)
       return node.sentinel
    end
    if node.type == "delta" then
-      return "delta " .. node.width .. "pt"
+      return "delta " .. tostring(node.width)
    end
    local before = self.nodes[node.curBreak - 1]
    local after = self.nodes[node.curBreak + 1]
@@ -620,31 +658,31 @@ function lineBreak:checkForLegalBreak (node) -- 892
       self.seenAlternatives = true
    end
    if self.sideways and node.is_box then
-      self.activeWidth:___add(node.height)
-      self.activeWidth:___add(node.depth)
+      self.activeWidth:add(node.height)
+      self.activeWidth:add(node.depth)
    elseif self.sideways and node.is_vglue then
       if previous and previous.is_box then
          self:tryBreak()
       end
-      self.activeWidth:___add(node.height)
-      self.activeWidth:___add(node.depth)
+      self.activeWidth:add(node.height)
+      self.activeWidth:add(node.depth)
    elseif node.is_alternative then
-      self.activeWidth:___add(node:minWidth())
+      self.activeWidth:add(node:minWidth())
    elseif node.is_box then
-      self.activeWidth:___add(node:lineContribution())
+      self.activeWidth:add(node:lineContribution())
    elseif node.is_glue then
       -- 894 (We removed the auto_breaking parameter)
       if previous and previous.is_box then
          self:tryBreak()
       end
-      self.activeWidth:___add(node.width)
+      self.activeWidth:add(node.width)
    elseif node.is_kern then
-      self.activeWidth:___add(node.width)
+      self.activeWidth:add(node.width)
    elseif node.is_discretionary then -- 895
-      self.activeWidth:___add(node:prebreakWidth())
+      self.activeWidth:add(node:prebreakWidth())
       self:tryBreak()
-      self.activeWidth:___sub(node:prebreakWidth())
-      self.activeWidth:___add(node:replacementWidth())
+      self.activeWidth:sub(node:prebreakWidth())
+      self.activeWidth:add(node:replacementWidth())
    elseif node.is_penalty then
       self:tryBreak()
    end
@@ -682,13 +720,714 @@ function lineBreak:tryFinalBreak () -- 899
    end
 end
 
+function lineBreak:startPass ()
+   -- 890
+   self.activeListHead = {
+      sentinel = "START",
+      type = "hyphenated",
+      lineNumber = awful_bad,
+      subtype = 0,
+   } -- 846
+   self.activeListHead.next = {
+      sentinel = "END",
+      type = "unhyphenated",
+      fitness = "decent",
+      next = self.activeListHead,
+      lineNumber = param("prevGraf") + 1,
+      totalDemerits = 0,
+   }
+
+   -- Not doing 1630
+   self.activeWidth:set(self.background)
+end
+
+-- Feed the nodes from the current place on to the breaker, until the end of
+-- the list or until no active nodes are left.
+function lineBreak:scanNodes ()
+   while self.nodes[self.place] and self.activeListHead.next ~= self.activeListHead do
+      self:checkForLegalBreak(self.nodes[self.place])
+      self.place = self.place + 1
+   end
+end
+
+function lineBreak:runPass ()
+   self:startPass()
+   self.place = 1
+   self:scanNodes()
+   self.failedAt = self.place - 1
+   if self.place > #self.nodes then
+      return self:tryFinalBreak()
+   end
+end
+
+local function metrics (dimension)
+   if type(dimension) == "number" then
+      return dimension, 0, 0
+   elseif SU.type(dimension) == "length" then
+      return dimension.length:tonumber(), dimension.stretch:tonumber(), dimension.shrink:tonumber()
+   end
+   return dimension:tonumber(), 0, 0
+end
+
+local function pushMetrics (array, n, dimension)
+   array[n + 1], array[n + 2], array[n + 3] = metrics(dimension)
+   return n + 3
+end
+
+-- Memo keys are two polynomial hashes of the paragraph, modulo primes below
+-- 2^26 so that every step is exact in doubles. Numbers count to the nearest
+-- 1/65536pt.
+local hashModuli, hashBases = { 67108859, 67108837 }, { 1000003, 999983 }
+
+local function hashInteger (hash, value)
+   for i = 1, 2 do
+      hash[i] = (hash[i] * hashBases[i] + value % hashModuli[i]) % hashModuli[i]
+   end
+end
+
+local function hashNumber (hash, value)
+   if value == math.huge or value == -math.huge or value ~= value then
+      hashInteger(hash, value > 0 and 1 or value < 0 and 2 or 3)
+   else
+      hashInteger(hash, math.floor(value * 65536 + 0.5))
+   end
+end
+
+local function hashString (hash, value)
+   hashInteger(hash, #value)
+   for i = 1, #value do
+      hashInteger(hash, value:byte(i))
+   end
+end
+
+-- Flatten the node list into the arrays of absolute numbers read by the native line breaker: for every node its kind,
+-- the width it adds to the line, the width subtracted when it is skipped at the start of a line, and its penalty or
+-- the index of its discretionary widths. Returns nil if the list holds nodes the native line breaker cannot handle.
+-- If from is given, the records of the nodes before it are kept from the previous flattening. If hash is given, the
+-- records and the text and language of the words (which decide hyphenation) are added to it for the memo key.
+function lineBreak:flattenNodes (from, hash)
+   local records, discretionaries = {}, {}
+   local n, d = 0, 0
+   local nodes = self.nodes
+   from = from or 1
+   if from > 1 and self.records then
+      records, discretionaries = self.records, self.discretionaries
+      n = (from - 1) * recordStride
+      for i = 1, n, recordStride do
+         if records[i] == kinds.discretionary then
+            d = d + discretionaryStride
+         end
+      end
+      for i = #records, n + 1, -1 do
+         records[i] = nil
+      end
+      for i = #discretionaries, d + 1, -1 do
+         discretionaries[i] = nil
+      end
+   else
+      from = 1
+   end
+   for i = from, #nodes do
+      local node = nodes[i]
+      local kind, advance, extra = kinds.other, 0, 0
+      if node.is_alternative then
+         return nil
+      elseif node.is_box then
+         kind, advance = kinds.box, node:lineContribution()
+      elseif node.is_glue then
+         kind, advance, extra = kinds.glue, node.width, node.penalty or 0
+      elseif node.is_kern then
+         kind, advance = kinds.kern, node.width
+      elseif node.is_discretionary then
+         kind, extra = kinds.discretionary, d / discretionaryStride
+         d = pushMetrics(discretionaries, d, node:prebreakWidth())
+         d = pushMetrics(discretionaries, d, node:postbreakWidth())
+         d = pushMetrics(discretionaries, d, node:replacementWidth())
+      elseif node.is_penalty then
+         kind, extra = kinds.penalty, node.penalty or 0
+      end
+      records[n + 1] = kind
+      n = pushMetrics(records, n + 1, advance)
+      n = pushMetrics(records, n, node.width and node:lineContribution() or 0)
+      records[n + 1] = extra
+      n = n + 1
+      if hash then
+         for j = n - recordStride + 1, n do
+            hashNumber(hash, records[j])
+         end
+         if kind == kinds.discretionary then
+            for j = d - discretionaryStride + 1, d do
+               hashNumber(hash, discretionaries[j])
+            end
+         elseif node.is_nnode then
+            hashString(hash, node.language or "")
+            hashString(hash, node.text or "")
+         end
+      end
+   end
+   return records, discretionaries
+end
+
+function lineBreak:nativeParams ()
+   return {
+      threshold = self.threshold,
+      finalpass = self.finalpass,
+      background = self.background.length,
+      backgroundStretch = self.background.stretch,
+      backgroundShrink = self.background.shrink,
+      firstWidth = self.firstWidth,
+      secondWidth = self.secondWidth,
+      easyLine = self.easy_line,
+      lastSpecialLine = self.lastSpecialLine,
+      linePenalty = param("linePenalty"),
+      hyphenPenalty = param("hyphenPenalty"),
+      doubleHyphenDemerits = param("doubleHyphenDemerits"),
+      adjdemerits = self.adjdemerits,
+      prevGraf = param("prevGraf"),
+   }
+end
+
+function lineBreak:applyNativeResult (found, positions)
+   if not found then
+      -- On failure the kernel returns the place after the node that ended its last active line
+      self.failedAt = positions - 1
+      return false
+   end
+   -- Without positions no final break had finite demerits, and as in tryFinalBreak the previous best bet stands
+   if positions then
+      local p
+      for i = 1, #positions do
+         p = { curBreak = positions[i], prevBreak = p }
+      end
+      self.bestBet = p or { sentinel = "END" }
+   end
+   return param("looseness") == 0 or self.finalpass
+end
+
+function lineBreak:runNativePass ()
+   return self:applyNativeResult(nativeBreaker.knuthplass(self.records, self.discretionaries, self:nativeParams()))
+end
+
+-- Run the second pass and, speculatively, the emergency pass on separate
+-- threads. Both see the same fully hyphenated paragraph; the emergency result
+-- is only used when the second pass would have been followed by it anyway.
+function lineBreak:runSpeculativePasses (threads)
+   local emergencyStretch = param("emergencyStretch"):tonumber()
+   local emergency = self:nativeParams()
+   emergency.backgroundStretch = emergency.backgroundStretch + emergencyStretch
+   emergency.finalpass = true
+   local results = nativeBreaker.knuthplass_batch({
+      { self.records, self.discretionaries, self:nativeParams() },
+      { self.records, self.discretionaries, emergency },
+   }, threads)
+   if self:applyNativeResult(results[1][1], results[1][2]) then
+      return true
+   end
+   self.pass = "emergency"
+   self.background.stretch = self.background.stretch + emergencyStretch
+   self.finalpass = true
+   return self:applyNativeResult(results[2][1], results[2][2])
+end
+
+-- Hyphenate the nodes from first up to the ones already hyphenated, or to the
+-- end of the list.
+function lineBreak:hyphenateFrom (first)
+   local nodes = self.nodes
+   local last = (self.hyphenatedFrom or #nodes + 1) - 1
+   if first == 1 and last == #nodes then
+      self.nodes = SILE.hyphenate(nodes)
+   else
+      local result = {}
+      for i = 1, first - 1 do
+         result[i] = nodes[i]
+      end
+      local hyphenated = SILE.hyphenate(pl.tablex.sub(nodes, first, last))
+      for i = 1, #hyphenated do
+         result[#result + 1] = hyphenated[i]
+      end
+      for i = last + 1, #nodes do
+         result[#result + 1] = nodes[i]
+      end
+      self.nodes = result
+   end
+   self.hyphenatedFrom = first
+   SILE.typesetter.state.nodes = self.nodes -- Horrible breaking of separation of concerns here. :-(
+end
+
+-- Where lazy hyphenation starts: far enough before the node at which the
+-- first pass ran out of feasible breaks for the lines ending there, and the
+-- one before, to be rebroken with hyphens.
+function lineBreak:lazyHyphenationStart ()
+   local nodes = self.nodes
+   local place = math.min(self.failedAt, #nodes)
+   local budget = 2 * SU.cast("number", self.hsize)
+   local width = 0
+   while place > 1 and width < budget do
+      local node = nodes[place]
+      if node.width then
+         width = width + SU.cast("number", node:lineContribution())
+      end
+      place = place - 1
+   end
+   return place
+end
+
+-- Paragraph break memo. Re-running a document (as the table of contents and
+-- index packages require) breaks the same paragraphs again. Results are
+-- keyed by a hash of the flattened node metrics, the text and language of the
+-- words (which decide hyphenation), the line widths and the settings read by
+-- the breaker. Entries keep the words the hyphenation pass split, if the
+-- paragraph needed it, so that a hit splits its own words the same way
+-- without hyphenating them again.
+local memo
+local memoFile = { loaded = 0 }
+
+local memoSettings = {
+   "tolerance",
+   "pretolerance",
+   "adjdemerits",
+   "looseness",
+   "prevGraf",
+   "emergencyStretch",
+   "linePenalty",
+   "hyphenPenalty",
+   "doubleHyphenDemerits",
+   "finalHyphenDemerits",
+   "hangIndent",
+   "hangAfter",
+   "parShape",
+}
+
+local function memoPath ()
+   local input = SILE.input and SILE.input.filenames and SILE.input.filenames[1]
+   return input and pl.path.splitext(input) .. ".breaks"
+end
+
+local function readMemo (path)
+   local fh = io.open(path, "r")
+   if not fh then
+      return 0
+   end
+   local count = 0
+   if fh:read("*l") == "sile-linebreak-memo 2" then
+      for line in fh:lines() do
+         local key, hyphenated, nodes, shape, breaks = line:match("^(%x+)\t(%d+)\t(%d+)\t([^\t]*)\t(.*)$")
+         if key then
+            local entry = {
+               hyphenated = tonumber(hyphenated),
+               count = tonumber(nodes),
+               shape = shape ~= "" and shape or nil,
+               breaks = {},
+            }
+            for value in breaks:gmatch("[^,]+") do
+               entry.breaks[#entry.breaks + 1] = tonumber(value)
+            end
+            memo:set(key, nil, entry)
+            count = count + 1
+         end
+      end
+   end
+   fh:close()
+   return count
+end
+
+local function writeMemo (path)
+   local tmp = path .. ".tmp"
+   local fh = io.open(tmp, "w")
+   if not fh then
+      SU.warn("Could not write paragraph break memo to " .. path)
+      return
+   end
+   fh:write("sile-linebreak-memo 2\n")
+   -- Oldest first, so that reloading keeps the recency order
+   for key, _, value in memo:entries() do
+      fh:write(
+         key,
+         "\t",
+         value.hyphenated,
+         "\t",
+         value.count,
+         "\t",
+         value.shape or "",
+         "\t",
+         table.concat(value.breaks, ","),
+         "\n"
+      )
+   end
+   fh:close()
+   os.rename(tmp, path)
+end
+
+--- Return the paragraph break memo, or nil if it is disabled.
+function lineBreak:memo ()
+   local capacity = param("memoSize")
+   if capacity <= 0 then
+      return nil
+   end
+   if not memo then
+      memo = SU.lru(capacity)
+   elseif memo.capacity ~= capacity then
+      memo:resize(capacity)
+   end
+   if not memoFile.path and param("persistMemo") then
+      memoFile.path = memoPath()
+      if memoFile.path then
+         memoFile.loaded = readMemo(memoFile.path)
+         SU.debug("break", "Loaded", memoFile.loaded, "memoized paragraph breaks from", memoFile.path)
+      end
+   end
+   return memo
+end
+
+-- Finish the memo key of a paragraph from the hash of its flattened nodes
+function lineBreak:memoKey (hash)
+   local parts = {
+      SU.cast("number", self.hsize),
+      self.background.length,
+      self.background.stretch,
+      self.background.shrink,
+   }
+   for i = 1, #memoSettings do
+      parts[#parts + 1] = tostring(param(memoSettings[i]))
+   end
+   hashString(hash, table.concat(parts, "|"))
+   return ("%07x%07x"):format(hash[1], hash[2])
+end
+
+-- The outputs of linebreak:parShape for the lines the breaker looked at
+function lineBreak:parShapeSignature (lines)
+   local shape = {}
+   for n = 1, lines do
+      local left, width, right = self:parShapeCache(n)
+      shape[n] = ("%s:%s:%s"):format(left, SU.cast("number", width), right)
+   end
+   return table.concat(shape, ";")
+end
+
+-- What else decides how the words of a memoized paragraph were split
+local function hyphenationState ()
+   return SILE.settings:get("font.hyphenchar") .. ":" .. SILE.hyphenator.serial
+end
+
+function lineBreak:memoize (cache, key, breaks, unhyphenated)
+   local entry = { hyphenated = self.hyphenatedFrom or 0, count = #self.nodes, breaks = {} }
+   for i = 1, #breaks do
+      local point = breaks[i]
+      if not point.position then
+         return
+      end
+      local flat = entry.breaks
+      flat[#flat + 1] = point.position
+      flat[#flat + 1] = SU.cast("number", point.left or 0)
+      flat[#flat + 1] = SU.cast("number", point.right or 0)
+   end
+   if self.parShaping then
+      entry.shape = self:parShapeSignature(self.parShapeLines)
+      self:parShapeCacheClear()
+   end
+   -- The nodes each word was split into, by position in the list before
+   -- hyphenation (not written to the memo file)
+   if entry.hyphenated > 0 then
+      entry.hyphenation = hyphenationState()
+      entry.words = {}
+      for i = entry.hyphenated, #unhyphenated do
+         local word = unhyphenated[i]
+         if word.children and word.hyphenated ~= nil then
+            entry.words[i] = word.children
+         end
+      end
+   end
+   cache:set(key, nil, entry)
+end
+
+-- Split the words of the paragraph the way those of a memoized one were,
+-- from where its hyphenation started, instead of hyphenating them again.
+function lineBreak:splitMemoizedWords (entry)
+   local nodes, result = self.nodes, {}
+   for i = 1, entry.hyphenated - 1 do
+      result[i] = nodes[i]
+   end
+   for i = entry.hyphenated, #nodes do
+      local word, pieces = nodes[i], entry.words[i]
+      if pieces then
+         local children = {}
+         for j, piece in ipairs(pieces) do
+            local child
+            -- Discretionaries are marked as they are used, so start afresh
+            if piece.is_discretionary then
+               child = SILE.types.node.discretionary({
+                  prebreak = piece.prebreak,
+                  postbreak = piece.postbreak,
+                  replacement = piece.replacement,
+               })
+            else
+               child = setmetatable(pl.tablex.copy(piece), getmetatable(piece))
+            end
+            child.parent = word
+            children[j] = child
+            result[#result + 1] = child
+         end
+         word.children, word.hyphenated, word.done = children, false, false
+      else
+         result[#result + 1] = word
+      end
+   end
+   self.nodes = result
+   self.hyphenatedFrom = entry.hyphenated
+   SILE.typesetter.state.nodes = result
+end
+
+function lineBreak:replayMemo (entry)
+   if entry.shape then
+      local shape = self:parShapeSignature(#pl.stringx.split(entry.shape, ";"))
+      self:parShapeCacheClear()
+      if shape ~= entry.shape then
+         return nil
+      end
+   end
+   if entry.hyphenated > 0 then
+      local nodes = self.nodes
+      if entry.words and entry.hyphenation == hyphenationState() then
+         self:splitMemoizedWords(entry)
+      else
+         self:hyphenateFrom(entry.hyphenated)
+      end
+      -- Hyphenation exceptions may have changed since the entry was made
+      if #self.nodes ~= entry.count then
+         self.nodes, self.hyphenatedFrom = nodes, nil
+         SILE.typesetter.state.nodes = nodes
+         return nil
+      end
+   elseif #self.nodes ~= entry.count then
+      return nil
+   end
+   local breaks = {}
+   for i = 1, #entry.breaks, 3 do
+      breaks[#breaks + 1] = {
+         position = entry.breaks[i],
+         width = self.hsize,
+         left = entry.breaks[i + 1],
+         right = entry.breaks[i + 2],
+      }
+   end
+   SU.debug("break", "Replayed", #breaks, "memoized breaks")
+   return breaks
+end
+
+--- Save new memoized paragraph breaks, if they are kept between runs.
+function lineBreak:finish ()
+   if not memo then
+      return
+   end
+   SU.debug("break", "Paragraph break memo:", memo:stats())
+   if memoFile.path and memo.count > 0 and memo.misses > 0 then
+      writeMemo(memoFile.path)
+      SU.debug("break", "Saved", memo.count, "memoized paragraph breaks to", memoFile.path)
+   end
+end
+
+--- Break a paragraph into lines.
+-- @tparam table nodes The nodes of the paragraph.
+-- @tparam measurement hsize The width of the lines.
+-- @tparam boolean sideways Whether the nodes are stacked vertically.
+-- @treturn table The breaks found.
+-- @treturn table The nodes the positions of the breaks index, which may be hyphenated copies of those given.
 function lineBreak:doBreak (nodes, hsize, sideways)
+   local windowSize = param("windowSize")
+   if windowSize > 0 and #nodes > windowSize and not sideways and self:canBreakInWindows() then
+      return self:doBreakInWindows(nodes, hsize, windowSize)
+   end
+   return self:breakParagraph(nodes, hsize, sideways)
+end
+
+-- Windowed breaking runs on the Lua line breaker, and a pass that fails only
+-- goes back to the start of the window it failed in, so it does not support
+-- paragraph shapes, hanging indentation or looseness.
+function lineBreak:canBreakInWindows ()
+   return not param("parShape") and param("hangIndent"):tonumber() == 0 and param("looseness") == 0
+end
+
+-- The active list as it is between two nodes, to go back to if a later pass
+-- has to scan a window again. Break nodes do not change once made, but the
+-- links between them and the widths of delta nodes do.
+local function saveActiveList (self)
+   local saved = { activeWidth = self.activeWidth:copy() }
+   local head = self.activeListHead
+   local p = head.next
+   while p ~= head do
+      saved[#saved + 1] = p
+      if p.type == "delta" then
+         saved[p] = p.width:copy()
+      end
+      p = p.next
+   end
+   return saved
+end
+
+local function restoreActiveList (self, saved)
+   local prev = self.activeListHead
+   for i = 1, #saved do
+      local p = saved[i]
+      if p.type == "delta" then
+         p.width = saved[p]:copy()
+      end
+      prev.next = p
+      prev = p
+   end
+   prev.next = self.activeListHead
+   self.activeWidth:set(saved.activeWidth)
+end
+
+-- Deactivate the active nodes whose lines up to the horizon are not those of
+-- the best one, and rebuild the delta nodes between those left.
+function lineBreak:commitLines (horizon)
+   local head = self.activeListHead
+   local best
+   local p = head.next
+   while p ~= head do
+      if p.type ~= "delta" and (not best or p.totalDemerits < best.totalDemerits) then
+         best = p
+      end
+      p = p.next
+   end
+   local function lastBreakBefore (node)
+      while node and node.curBreak and node.curBreak > horizon do
+         node = node.prevBreak
+      end
+      return node
+   end
+   local committed = best and lastBreakBefore(best)
+   if not committed or committed == best then
+      return
+   end
+   -- The widths of the active nodes kept, relative to the first one
+   local kept, offsets = {}, {}
+   local offset = SILE.types.packedlength()
+   p = head.next
+   while p ~= head do
+      if p.type == "delta" then
+         offset:add(p.width)
+      elseif lastBreakBefore(p) == committed then
+         kept[#kept + 1], offsets[#kept + 1] = p, offset:copy()
+      end
+      p = p.next
+   end
+   local prev = head
+   for i = 1, #kept do
+      if i == 1 then
+         self.activeWidth:add(offsets[1])
+      else
+         local width = offsets[i]:copy():sub(offsets[i - 1])
+         if width.length ~= 0 or width.stretch ~= 0 or width.shrink ~= 0 then
+            local delta = { type = "delta", width = width }
+            prev.next = delta
+            prev = delta
+         end
+      end
+      prev.next = kept[i]
+      prev = kept[i]
+   end
+   prev.next = head
+end
+
+-- Break a very long paragraph by feeding its nodes to the breaker one window
+-- at a time. The active list is carried on from one window to the next, so
+-- nothing is broken twice: once a window is scanned, only the active nodes
+-- whose lines up to a window back agree with those of the best one are kept,
+-- which bounds the active list, and the lines before that are committed. The
+-- result is the same as for the whole paragraph unless the best breaks depend
+-- on material more than a window ahead, or a pass fails: a later pass then
+-- hyphenates and scans again only the window the failure happened in, and
+-- carries on for the rest of the paragraph. The paragraph is not changed;
+-- the broken nodes are returned as a new list.
+function lineBreak:doBreakInWindows (nodes, hsize, windowSize)
+   passSerial = 1
+   debugging = SILE.debugFlags["break"]
+   self.seenAlternatives = false
+   self.parShapeLines = 0
+   self.failedAt, self.hyphenatedFrom = nil, nil
+   self.nodes = {}
+   self.hsize = hsize
+   self.sideways = false
+   self:init()
+   self.adjdemerits = param("adjdemerits")
+   self.threshold = param("pretolerance")
+   if self.threshold >= 0 then
+      self.pass = "first"
+      self.finalpass = false
+   else
+      self.threshold = param("tolerance")
+      self.pass = "second"
+      self.finalpass = param("emergencyStretch") <= 0
+   end
+   self:startPass()
+   -- As trimGlue, but on the copy
+   local count = nodes[#nodes].is_glue and #nodes - 1 or #nodes
+   local first = 1
+   while first <= count do
+      -- Windows end before a box, so that the discardable nodes after a break
+      -- are all in the same window as the break
+      local last = math.min(first + windowSize - 1, count)
+      while last < count and not nodes[last + 1].is_box do
+         last = last + 1
+      end
+      local window = pl.tablex.sub(nodes, first, last)
+      if last == count then
+         window[#window + 1] = SILE.types.node.penalty(inf_bad)
+      end
+      local mark, saved = #self.nodes, saveActiveList(self)
+      local hyphenated
+      while true do
+         if self.threshold > inf_bad then
+            self.threshold = inf_bad
+         end
+         if self.pass ~= "first" then
+            hyphenated = hyphenated or SILE.hyphenate(window)
+         end
+         local slice = hyphenated or window
+         table.move(slice, 1, #slice, mark + 1, self.nodes)
+         self.place = mark + 1
+         self:scanNodes()
+         if self.place > #self.nodes then
+            break
+         end
+         SU.debug("break", "The", self.pass, "pass failed in the window from node", first)
+         for i = #self.nodes, mark + 1, -1 do
+            self.nodes[i] = nil
+         end
+         restoreActiveList(self, saved)
+         if self.pass ~= "second" then
+            self.pass = "second"
+            self.threshold = param("tolerance")
+         else
+            self.pass = "emergency"
+            local emergencyStretch = param("emergencyStretch"):tonumber()
+            self.background.stretch = self.background.stretch + emergencyStretch
+            self.activeWidth.stretch = self.activeWidth.stretch + emergencyStretch
+            self.finalpass = true
+         end
+      end
+      if last < count then
+         self:commitLines(#self.nodes - windowSize)
+      end
+      first = last + 1
+   end
+   self:tryFinalBreak()
+   local breaks = self:postLineBreak()
+   SILE.typesetter.state.nodes = self.nodes -- As hyphenateFrom does
+   return breaks, self.nodes
+end
+
+function lineBreak:breakParagraph (nodes, hsize, sideways)
    passSerial = 1
    debugging = SILE.debugFlags["break"]
    self.seenAlternatives = false
+   self.parShapeLines = 0
+   self.failedAt, self.hyphenatedFrom = nil, nil
    self.nodes = nodes
    self.hsize = hsize
    self.sideways = sideways
+   self:trimGlue() -- 842
    self:init()
    self.adjdemerits = param("adjdemerits")
    self.threshold = param("pretolerance")
@@ -700,6 +1439,23 @@ function lineBreak:doBreak (nodes, hsize, sideways)
       self.pass = "second"
       self.finalpass = param("emergencyStretch") <= 0
    end
+   local native = has_native and not self.sideways and not self.parShaping and not debugging and param("native")
+   local memo = not self.sideways and self:memo()
+   local hash = memo and { 0, 0 }
+   if native or memo then
+      self.records, self.discretionaries = self:flattenNodes(nil, hash)
+   end
+   local key
+   local unhyphenated = self.nodes
+   if memo and self.records then
+      key = self:memoKey(hash)
+      local entry = memo:get(key)
+      local breaks = entry and self:replayMemo(entry)
+      if breaks then
+         self.records, self.discretionaries = nil, nil
+         return breaks, self.nodes
+      end
+   end
    -- 889
    while 1 do
       if debugging then
@@ -709,50 +1465,52 @@ function lineBreak:doBreak (nodes, hsize, sideways)
          self.threshold = inf_bad
       end
       if self.pass == "second" then
-         self.nodes = SILE.hyphenate(self.nodes)
-         SILE.typesetter.state.nodes = self.nodes -- Horrible breaking of separation of concerns here. :-(
-      end
-      -- 890
-      self.activeListHead = {
-         sentinel = "START",
-         type = "hyphenated",
-         lineNumber = awful_bad,
-         subtype = 0,
-      } -- 846
-      self.activeListHead.next = {
-         sentinel = "END",
-         type = "unhyphenated",
-         fitness = "decent",
-         next = self.activeListHead,
-         lineNumber = param("prevGraf") + 1,
-         totalDemerits = 0,
-      }
-
-      -- Not doing 1630
-      self.activeWidth = SILE.types.length(self.background)
-
-      self.place = 1
-      while self.nodes[self.place] and self.activeListHead.next ~= self.activeListHead do
-         self:checkForLegalBreak(self.nodes[self.place])
-         self.place = self.place + 1
-      end
-      if self.place > #self.nodes then
-         if self:tryFinalBreak() then
-            break
+         -- After a failed first pass, lazy hyphenation leaves alone the words
+         -- the first pass could set, keeping their flattened records
+         local from = 1
+         if self.failedAt and param("lazyHyphenation") then
+            from = self:lazyHyphenationStart()
+         end
+         self:hyphenateFrom(from)
+         if native then
+            self.records, self.discretionaries = self:flattenNodes(from)
+         end
+      elseif self.pass == "emergency" and self.hyphenatedFrom > 1 then
+         -- The emergency pass gets a fully hyphenated paragraph
+         self:hyphenateFrom(1)
+         if native then
+            self.records, self.discretionaries = self:flattenNodes()
          end
       end
+      local done
+      local threads = native and self.records and param("threads") or 1
+      if threads > 1 and self.pass == "second" and not self.finalpass and self.hyphenatedFrom == 1 then
+         done = self:runSpeculativePasses(threads)
+      elseif native and self.records then
+         done = self:runNativePass()
+      else
+         done = self:runPass()
+      end
+      if done then
+         break
+      end
       -- (Not doing 891)
       if self.pass ~= "second" then
          self.pass = "second"
          self.threshold = param("tolerance")
       else
          self.pass = "emergency"
-         self.background.stretch:___add(param("emergencyStretch"))
+         self.background.stretch = self.background.stretch + param("emergencyStretch"):tonumber()
          self.finalpass = true
       end
    end
+   self.records, self.discretionaries = nil, nil
    -- Not doing 1638
-   return self:postLineBreak()
+   local breaks = self:postLineBreak()
+   if key then
+      self:memoize(memo, key, breaks, unhyphenated)
+   end
+   return breaks, self.nodes
 end
 
 function lineBreak:postLineBreak () -- 903
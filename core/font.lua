@@ -143,6 +143,12 @@ SILE.settings:declare({ parameter = "font.filename", type = "string or nil", def
 SILE.settings:declare({ parameter = "font.features", type = "string", default = "" })
 SILE.settings:declare({ parameter = "font.variations", type = "string", default = "" })
 SILE.settings:declare({ parameter = "font.hyphenchar", type = "string", default = "-" })
+SILE.settings:declare({
+   parameter = "font.matchcache",
+   type = "string or nil",
+   default = "",
+   help = "File in which to keep fontconfig matches between runs, empty to disable",
+})
 
 SILE.fontCache = {}
 
@@ -220,10 +226,11 @@ local font = {
    end,
 
    finish = function ()
+      SILE.fontManager:finish()
       for key, font in pairs(SILE.fontCache) do
          -- Don't do anything for Pango fonts
          if type(font) ~= "userdata" and type(font.insert) ~= "function" then
-            if font.tempfilename ~= font.filename then
+            if font.tempfilename ~= font.filename and not font.tempfilecached then
                SU.debug("fonts", "Removing temporary file of", key, ":", font.tempfilename)
                os.remove(font.tempfilename)
             end
@@ -21,7 +21,84 @@ local function create_macfonts_fallback (self)
    end
 end
 
+-- Fontconfig matches are memoized in process; when font.matchcache names a
+-- file they are also kept there between runs, for as long as fontconfig's
+-- configuration and caches stay unchanged.
+local matchCache = { path = nil, loaded = 0 }
+
+local _readMatches = function (path, stamp)
+   local fh = io.open(path, "r")
+   if not fh then
+      return {}
+   end
+   local matches = {}
+   if fh:read("*l") == "sile-fontconfig-matches " .. stamp then
+      for line in fh:lines() do
+         local key, filename, index, family, fullname = line:match("^([^\t]*)\t([^\t]*)\t(%d+)\t([^\t]*)\t?(.*)$")
+         if key then
+            matches[#matches + 1] = {
+               key = key,
+               filename = filename,
+               index = tonumber(index),
+               family = family,
+               fullname = fullname ~= "" and fullname or nil,
+            }
+         end
+      end
+   end
+   fh:close()
+   return matches
+end
+
+local _writeMatches = function (path, stamp, matches)
+   local tmp = path .. ".tmp"
+   local fh = io.open(tmp, "w")
+   if not fh then
+      return
+   end
+   fh:write("sile-fontconfig-matches ", stamp, "\n")
+   for _, match in ipairs(matches) do
+      local fields = { match.key, match.filename, tostring(match.index), match.family, match.fullname or "" }
+      local line = table.concat(fields, "\t")
+      if not line:find("\n") and select(2, line:gsub("\t", "")) == 4 then
+         fh:write(line, "\n")
+      end
+   end
+   fh:close()
+   os.rename(tmp, path)
+end
+
+local _loadMatchCache = function (self)
+   local path = SILE.settings:get("font.matchcache")
+   if not path or path == "" or path == matchCache.path then
+      return
+   end
+   matchCache.path = path
+   matchCache.stamp = self.fontconfig._cache_stamp()
+   if not matchCache.stamp then
+      return
+   end
+   local matches = _readMatches(path, matchCache.stamp)
+   self.fontconfig._prime(matches)
+   matchCache.loaded = #self.fontconfig._matches()
+   SU.debug("fonts", "Loaded", #matches, "fontconfig matches from", path)
+end
+
+--- Save new fontconfig matches to the match cache file, if one is in use.
+fontManager.finish = function (self)
+   if not matchCache.path or not matchCache.stamp then
+      return
+   end
+   local matches = self.fontconfig._matches()
+   if #matches > matchCache.loaded then
+      _writeMatches(matchCache.path, matchCache.stamp, matches)
+      matchCache.loaded = #matches
+      SU.debug("fonts", "Saved", #matches, "fontconfig matches to", matchCache.path)
+   end
+end
+
 fontManager.face = function (self, ...)
+   _loadMatchCache(self)
    local face
    if SILE.input.fontmanager then
       face = self[SILE.input.fontmanager]._face
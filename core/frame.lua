@@ -5,8 +5,51 @@ SILE.frames = {}
 -- See https://github.com/sile-typesetter/sile/issues/694
 
 local cassowary = require("cassowary")
+local lpeg = require("lpeg")
 local solver = cassowary.SimplexSolver()
-local solverNeedsReloading = true
+local solverNeedsUpdating = true
+
+-- What is in the solver: the page frame and its constraints as they were when
+-- the solver was built, and for every other frame the equations of its width
+-- and height and of each of its constraints.
+local reifiedPage = false
+local reified = {}
+
+-- Relative units (em, bs, %fw, %lw...) in a constraint are resolved when it is
+-- parsed, so what was solved with it only holds while they resolve to the same
+-- lengths as they did then. Returns those lengths, to compare.
+local relativeLengths
+local function resolvedLengths (constraint)
+   if not constraint then
+      return ""
+   end
+   if not relativeLengths then
+      local resolve = function (parsed)
+         local unit = SILE.types.unit[parsed.unit]
+         if unit and unit.relative then
+            return SILE.types.measurement(parsed):tonumber()
+         end
+      end
+      relativeLengths = lpeg.Ct(((SILE.parserBits.measurement / resolve) + 1) ^ 0)
+   end
+   return table.concat(relativeLengths:match(tostring(constraint)), ",")
+end
+
+local function resolvedPageLengths (page)
+   local lengths = {}
+   for method, constraint in pairs(page and page.constraints or {}) do
+      lengths[method] = resolvedLengths(constraint)
+   end
+   return lengths
+end
+
+-- Set when the frames were given their geometry from a cached layout, so
+-- that the solver does not know about them yet
+local solverIsBehind = false
+
+-- Solved geometry of the frames of new pages, keyed by the frames and their
+-- constraints, which include the paper size as constraints of the page frame
+local layouts = {}
 
 local widthdims = pl.Set({ "left", "right", "width" })
 local heightdims = pl.Set({ "top", "bottom", "height" })
@@ -71,11 +114,12 @@ SILE.framePrototype = pl.class({
    end,
 
    invalidate = function ()
-      solverNeedsReloading = true
+      solverNeedsUpdating = true
    end,
 
    relax = function (self, method)
       self.constraints[method] = nil
+      self:invalidate()
    end,
 
    reifyConstraint = function (self, solver, method, stay)
@@ -92,38 +136,127 @@ SILE.framePrototype = pl.class({
       if stay then
          solver:addStay(eq)
       end
+      -- The variables of other frames the equation depends on
+      local variables = {}
+      if type(constraint) == "table" then
+         if constraint.terms then
+            for clv, _ in pairs(constraint.terms) do
+               variables[#variables + 1] = clv
+            end
+         else
+            variables[1] = constraint
+         end
+      end
+      return {
+         constraint = self.constraints[method],
+         lengths = resolvedLengths(self.constraints[method]),
+         equation = eq,
+         variables = variables,
+      }
    end,
 
    addWidthHeightDefinitions = function (self, solver)
       local vars = self.variables
-      solver:addConstraint(cassowary.Equation(vars.width, cassowary.minus(vars.right, vars.left)))
-      solver:addConstraint(cassowary.Equation(vars.height, cassowary.minus(vars.bottom, vars.top)))
+      local width = cassowary.Equation(vars.width, cassowary.minus(vars.right, vars.left))
+      local height = cassowary.Equation(vars.height, cassowary.minus(vars.bottom, vars.top))
+      solver:addConstraint(width)
+      solver:addConstraint(height)
+      return width, height
    end,
 
-   -- This is hideously inefficient,
-   -- but it's the easiest way to allow users to reconfigure frames at runtime.
+   -- Frames can be reconfigured at any time, so the solver is brought up to
+   -- date with them before their dimensions are read. Only the constraints
+   -- that changed, and those of frames that came or went, are taken out of
+   -- and put into the solver; it is only built again if the page changed.
    solve = function (_)
-      if not solverNeedsReloading then
+      if not solverNeedsUpdating then
          return
       end
       SU.debug("frames", "Solving...")
-      solver = cassowary.SimplexSolver()
-      if SILE.frames.page then
-         for method, _ in pairs(SILE.frames.page.constraints) do
-            SILE.frames.page:reifyConstraint(solver, method, true)
+      local page = SILE.frames.page
+      if
+         not reifiedPage
+         or reifiedPage.frame ~= page
+         or not pl.tablex.deepcompare(reifiedPage.constraints, page and page.constraints or {})
+         or not pl.tablex.deepcompare(reifiedPage.lengths, resolvedPageLengths(page))
+      then
+         SU.debug("frames", "Reloading the solver")
+         solver = cassowary.SimplexSolver()
+         reified = {}
+         reifiedPage = {
+            frame = page,
+            constraints = page and pl.tablex.copy(page.constraints) or {},
+            lengths = resolvedPageLengths(page),
+         }
+         if page then
+            for method, _ in pairs(page.constraints) do
+               page:reifyConstraint(solver, method, true)
+            end
+            page:addWidthHeightDefinitions(solver)
+         end
+      end
+      local live = {}
+      for _, frame in pairs(SILE.frames) do
+         for _, variable in pairs(frame.variables) do
+            live[variable] = true
+         end
+      end
+      -- Take out everything that no longer holds before putting anything in,
+      -- so the solver never sees an old constraint and its replacement at once
+      for frame, entry in pairs(reified) do
+         if SILE.frames[frame.id] ~= frame then
+            for _, record in pairs(entry.constraints) do
+               solver:removeConstraint(record.equation)
+            end
+            solver:removeConstraint(entry.width)
+            solver:removeConstraint(entry.height)
+            reified[frame] = nil
+         else
+            for method, record in pairs(entry.constraints) do
+               local stale = frame.constraints[method] ~= record.constraint
+                  or resolvedLengths(record.constraint) ~= record.lengths
+               for i = 1, #record.variables do
+                  -- A frame it depends on was replaced by another of the same id
+                  stale = stale or not live[record.variables[i]]
+               end
+               if stale then
+                  solver:removeConstraint(record.equation)
+                  entry.constraints[method] = nil
+               end
+            end
          end
-         SILE.frames.page:addWidthHeightDefinitions(solver)
       end
+      local pending = {}
       for id, frame in pairs(SILE.frames) do
-         if not (id == "page") then
+         if id ~= "page" then
+            pending[#pending + 1] = frame
+         end
+      end
+      while #pending > 0 do
+         for _, frame in ipairs(pending) do
+            local entry = reified[frame]
+            if not entry then
+               entry = { constraints = {} }
+               entry.width, entry.height = frame:addWidthHeightDefinitions(solver)
+               reified[frame] = entry
+            end
             for method, _ in pairs(frame.constraints) do
-               frame:reifyConstraint(solver, method)
+               if not entry.constraints[method] then
+                  entry.constraints[method] = frame:reifyConstraint(solver, method)
+               end
+            end
+         end
+         -- Constraints may refer to frames not declared yet, which get declared as they are parsed
+         pending = {}
+         for id, frame in pairs(SILE.frames) do
+            if id ~= "page" and not reified[frame] then
+               pending[#pending + 1] = frame
             end
-            frame:addWidthHeightDefinitions(solver)
          end
       end
       solver:solve()
-      solverNeedsReloading = false
+      solverNeedsUpdating = false
+      solverIsBehind = false
    end,
 
    writingDirection = function (self)
@@ -294,16 +427,68 @@ SILE.getFrame = function (id)
    return frame or SU.warn("Couldn't find frame ID " .. id, true)
 end
 
+local function layoutKey ()
+   local ids = {}
+   for id, _ in pairs(SILE.frames) do
+      ids[#ids + 1] = id
+   end
+   table.sort(ids)
+   local key = {}
+   for _, id in ipairs(ids) do
+      local constraints = SILE.frames[id].constraints
+      key[#key + 1] = id
+      for _, method in ipairs({ "left", "right", "width", "top", "bottom", "height" }) do
+         key[#key + 1] = constraints[method] or ""
+         key[#key + 1] = resolvedLengths(constraints[method])
+      end
+   end
+   return table.concat(key, ";")
+end
+
+-- Give the frames of a new page their geometry. Pages set up with the same
+-- frames as an earlier one, as every page from the same master is, take it
+-- from the layout solved then; the solver only catches up with them once a
+-- frame is changed during the page.
+SILE.layoutFrames = function ()
+   local key = layoutKey()
+   local layout = layouts[key]
+   if layout then
+      SU.debug("frames", "Reusing a solved layout")
+      for id, frame in pairs(SILE.frames) do
+         for method, variable in pairs(frame.variables) do
+            variable.value = layout[id][method]
+         end
+      end
+      solverNeedsUpdating = false
+      solverIsBehind = true
+   else
+      solverNeedsUpdating = true
+      SILE.frames.page:solve()
+      layout = {}
+      for id, frame in pairs(SILE.frames) do
+         layout[id] = {}
+         for method, variable in pairs(frame.variables) do
+            layout[id][method] = variable.value
+         end
+      end
+      layouts[key] = layout
+   end
+end
+
 SILE.parseComplexFrameDimension = function (dimension)
    local length = SILE.frameParser:match(SU.cast("string", dimension))
    if type(length) == "table" then
       local g = cassowary.Variable({ name = "t" })
       local eq = cassowary.Equation(g, length)
-      solverNeedsReloading = true
-      solver:addConstraint(eq)
+      if solverIsBehind then
+         solverNeedsUpdating = true
+      end
       SILE.frames.page:solve()
-      solverNeedsReloading = true
-      return g.value
+      solver:addConstraint(eq)
+      solver:solve()
+      local value = g.value
+      solver:removeConstraint(eq)
+      return value
    end
    return length
 end
@@ -1,3 +1,31 @@
+local lfs = require("lfs")
+local has_native, nativeHyphenator = pcall(require, "justenoughhyphen")
+
+local _defaultPatternCache = function ()
+   local base = os.getenv("XDG_CACHE_HOME")
+   if not base or base == "" then
+      local home = os.getenv("HOME")
+      if not home or home == "" then
+         return nil
+      end
+      base = pl.path.join(home, ".cache")
+   end
+   return pl.path.join(base, "sile", "hyphenation")
+end
+
+SILE.settings:declare({
+   parameter = "hyphenator.patterncache",
+   type = "string or nil",
+   default = _defaultPatternCache(),
+   help = "Directory in which to keep compiled hyphenation patterns between runs, empty to disable",
+})
+SILE.settings:declare({
+   parameter = "hyphenator.wordcachesize",
+   type = "integer",
+   default = 20000,
+   help = "Maximum number of hyphenated words cached per language, 0 to disable the cache",
+})
+
 local function addPattern (hyphenator, pattern)
    local trie = hyphenator.trie
    local bits = SU.splitUtf8(pattern)
@@ -28,7 +56,20 @@ end
 local function registerException (hyphenator, exception)
    local text = exception:gsub("-", "")
    local bits = SU.splitUtf8(exception)
+   -- Cached results for the word, in any case, are stale
+   if hyphenator.cache then
+      local stale = {}
+      for key, subkey in hyphenator.cache:entries() do
+         if luautf8.lower(key) == text then
+            stale[#stale + 1] = { key, subkey }
+         end
+      end
+      for _, entry in ipairs(stale) do
+         hyphenator.cache:remove(entry[1], entry[2])
+      end
+   end
    hyphenator.exceptions[text] = {}
+   SILE.hyphenator.serial = SILE.hyphenator.serial + 1
    local j = 1
    for _, bit in ipairs(bits) do
       j = j + 1
@@ -41,6 +82,40 @@ local function registerException (hyphenator, exception)
    end
 end
 
+local function patternCacheDir ()
+   local dir = SILE.settings:get("hyphenator.patterncache")
+   if not dir or dir == "" then
+      return nil
+   end
+   if lfs.attributes(dir, "mode") ~= "directory" and not pl.dir.makepath(dir) then
+      return nil
+   end
+   return dir
+end
+
+-- Compiled patterns are cached in files named after the language and a digest
+-- of its pattern list, so that edited patterns get recompiled.
+local function compilePatterns (language, patterns)
+   local dir = patternCacheDir()
+   local name = ("%s-%s.hyf"):format(language:gsub("[^%w_-]", "_"), nativeHyphenator.digest(patterns))
+   local path = dir and pl.path.join(dir, name)
+   local compiled = path and nativeHyphenator.open(path)
+   if compiled then
+      SU.debug("hyphenator", "Loaded compiled patterns for", language, "from", path)
+      return compiled
+   end
+   compiled = nativeHyphenator.compile(patterns)
+   if path then
+      local tmp = path .. ".tmp"
+      if compiled:save(tmp) and os.rename(tmp, path) then
+         SU.debug("hyphenator", "Saved compiled patterns for", language, "to", path)
+      else
+         os.remove(tmp)
+      end
+   end
+   return compiled
+end
+
 local function loadPatterns (hyphenator, language)
    SILE.languageSupport.loadLanguage(language)
 
@@ -49,8 +124,12 @@ local function loadPatterns (hyphenator, language)
       print("No patterns for language " .. language)
       return
    end
-   for _, pattern in ipairs(languageset.patterns) do
-      addPattern(hyphenator, pattern)
+   if has_native then
+      hyphenator.compiled = compilePatterns(language, languageset.patterns)
+   else
+      for _, pattern in ipairs(languageset.patterns) do
+         addPattern(hyphenator, pattern)
+      end
    end
    if not languageset.exceptions then
       languageset.exceptions = {}
@@ -77,12 +156,23 @@ local function loadPatterns (hyphenator, language)
    end
 end
 
-SILE._hyphenate = function (self, text)
-   if luautf8.len(text) < self.minWord then
-      return { text }
+-- Split a word after each of the given byte offsets
+local function splitAt (text, offsets)
+   local pieces, last = {}, 0
+   for i = 1, #offsets do
+      pieces[i] = text:sub(last + 1, offsets[i])
+      last = offsets[i]
    end
+   pieces[#pieces + 1] = text:sub(last + 1)
+   return pieces
+end
+
+local function hyphenateWord (self, text)
    local lowertext = luautf8.lower(text)
    local points = self.exceptions[lowertext]
+   if not points and self.compiled then
+      return splitAt(text, { self.compiled:hyphenate(text, lowertext, self.leftmin, self.rightmin) })
+   end
    local word = SU.splitUtf8(text)
    if not points then
       points = SU.map(function ()
@@ -117,17 +207,54 @@ SILE._hyphenate = function (self, text)
          points[i] = 0
       end
    end
-   local pieces = { "" }
+   local offsets, offset = {}, 0
    for i = 1, #word do
-      pieces[#pieces] = pieces[#pieces] .. word[i]
+      offset = offset + #word[i]
       if points[1 + i] and 1 == (points[1 + i] % 2) then
-         table.insert(pieces, "")
+         offsets[#offsets + 1] = offset
       end
    end
-   return pieces
+   return splitAt(text, offsets)
+end
+
+-- Results are cached per hyphenator, for the minima they were computed with
+local function wordCache (self)
+   local capacity = SILE.settings:get("hyphenator.wordcachesize")
+   if capacity <= 0 then
+      return nil
+   end
+   if not self.cache then
+      self.cache = SU.lru(capacity)
+   elseif self.cache.capacity ~= capacity then
+      self.cache:resize(capacity)
+   end
+   return self.cache
+end
+
+SILE._hyphenate = function (self, text)
+   if luautf8.len(text) < self.minWord then
+      return { text }
+   end
+   local cache = wordCache(self)
+   local minima = self.leftmin * 1000 + self.rightmin
+   local pieces = cache and cache:get(text, minima)
+   if not pieces then
+      pieces = hyphenateWord(self, text)
+      if cache then
+         cache:set(text, minima, pieces)
+      end
+   end
+   -- Segment hooks may rewrite the pieces they are given
+   local copy = {}
+   for i = 1, #pieces do
+      copy[i] = pieces[i]
+   end
+   return copy
 end
 
 SILE.hyphenator = {}
+-- Bumped whenever exceptions change, for callers that keep hyphenated nodes
+SILE.hyphenator.serial = 0
 SILE.hyphenator.languages = {}
 SILE._hyphenators = {}
 
@@ -143,7 +270,9 @@ local initHyphenator = function (lang)
          leftmin = 2, -- Minimum number of characters to the left of the hyphen (TeX default)
          rightmin = 2, -- Minimum number of characters to the right of the hyphen (TeX default)
          trie = {}, -- Trie resulting from the patterns
+         compiled = nil, -- Compiled patterns, used instead of the trie when the native hyphenator is available
          exceptions = {}, -- Hyphenation exceptions
+         cache = nil, -- Recently hyphenated words
       }
       loadPatterns(SILE._hyphenators[lang], lang)
    end
@@ -193,6 +322,17 @@ local hyphenateNode = function (node)
    return { node }
 end
 
+--- Report the word cache statistics of each hyphenator.
+SILE.hyphenator.finish = function ()
+   for language, hyphenator in pairs(SILE._hyphenators) do
+      if hyphenator.cache then
+         SU.debug("hyphenator", function ()
+            return "Word cache for " .. language .. ": " .. hyphenator.cache:stats()
+         end)
+      end
+   end
+end
+
 SILE.showHyphenationPoints = function (word, language)
    language = language or "en"
    initHyphenator(language)
@@ -58,6 +58,9 @@ end
 local function finish ()
    SILE.documentState.documentClass:finish()
    SILE.font.finish()
+   SILE.shaper:finish()
+   SILE.linebreak:finish()
+   SILE.hyphenator.finish()
    runEvals(SILE.input.evaluateAfters, "evaluate-after")
    if SILE.makeDeps then
       SILE.makeDeps:write()
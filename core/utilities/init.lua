@@ -101,6 +101,25 @@ function utilities.splice (array, start, stop, replacement)
    return array
 end
 
+--- Remove the first values of an array in one move.
+-- Unlike repeated `table.remove(array, 1)`, which shifts the rest of the array once per value removed, the remaining
+-- values are moved down once, so taking a page of lines off a long output queue costs time linear in the queue.
+-- @tparam table array Array to modify.
+-- @tparam integer count Number of values to remove, clamped to the length of the array.
+-- @treturn table New array of the values removed.
+function utilities.shift (array, count)
+   local length = #array
+   if count > length then
+      count = length
+   end
+   local removed = table.move(array, 1, count, 1, {})
+   table.move(array, count + 1, length, 1)
+   for i = length - count + 1, length do
+      array[i] = nil
+   end
+   return removed
+end
+
 -- TODO: Unused, now deprecated?
 function utilities.inherit (orig, spec)
    local new = pl.tablex.deepcopy(orig)
@@ -826,6 +845,8 @@ utilities.formatNumber = require("core.utilities.numbers")
 
 utilities.collatedSort = require("core.utilities.sorting")
 
+utilities.lru = require("core.utilities.lru")
+
 utilities.ast = require("core.utilities.ast")
 utilities.debugAST = utilities.ast.debug
 
@@ -221,6 +221,21 @@ describe("SILE.utilities", function ()
       end)
    end)
 
+   describe("shift", function ()
+      it("should remove values from the front of an array", function ()
+         local array = { "a", "b", "c", "d", "e" }
+         assert.same({ "a", "b" }, SU.shift(array, 2))
+         assert.same({ "c", "d", "e" }, array)
+      end)
+
+      it("should remove at most the whole array", function ()
+         local array = { "a", "b" }
+         assert.same({ "a", "b" }, SU.shift(array, 5))
+         assert.same({}, array)
+         assert.same({}, SU.shift(array, 1))
+      end)
+   end)
+
    describe("utf8_to_utf16be_hexencoded", function ()
       it("should hex encode input", function ()
          local str = "foo"
@@ -0,0 +1,146 @@
+--- Bounded least-recently-used cache.
+-- Entries are addressed by a key and an optional subkey, so that callers with composite keys (e.g. a font id and a
+-- string of text) do not have to build a new string for every lookup. Each entry carries a weight and the cache evicts
+-- the least recently used entries once the total weight exceeds its capacity. Hit, miss and eviction counts are kept
+-- for tuning.
+-- @module SU.lru
+
+local lru = pl.class()
+
+--- Create a new cache.
+-- @tparam number capacity Maximum total weight of the entries kept.
+function lru:_init (capacity)
+   self.capacity = capacity or math.huge
+   self:clear()
+end
+
+--- Drop all entries and reset the statistics.
+function lru:clear ()
+   self._map = {}
+   self._head = {}
+   self._head.prev, self._head.next = self._head, self._head
+   self.count = 0
+   self.weight = 0
+   self.hits = 0
+   self.misses = 0
+   self.evictions = 0
+end
+
+local function unlink (entry)
+   entry.prev.next = entry.next
+   entry.next.prev = entry.prev
+end
+
+local function pushFront (head, entry)
+   entry.prev = head
+   entry.next = head.next
+   head.next.prev = entry
+   head.next = entry
+end
+
+--- Look up an entry, marking it as most recently used.
+-- @param key Key.
+-- @param[opt] subkey Second part of the key.
+-- @return The cached value, or nil.
+function lru:get (key, subkey)
+   local bucket = self._map[key]
+   local entry = bucket and bucket[subkey == nil and true or subkey]
+   if not entry then
+      self.misses = self.misses + 1
+      return nil
+   end
+   self.hits = self.hits + 1
+   if self._head.next ~= entry then
+      unlink(entry)
+      pushFront(self._head, entry)
+   end
+   return entry.value
+end
+
+--- Remove an entry.
+-- @param key Key.
+-- @param[opt] subkey Second part of the key.
+function lru:remove (key, subkey)
+   subkey = subkey == nil and true or subkey
+   local bucket = self._map[key]
+   local entry = bucket and bucket[subkey]
+   if entry then
+      unlink(entry)
+      bucket[subkey] = nil
+      if next(bucket) == nil then
+         self._map[key] = nil
+      end
+      self.count = self.count - 1
+      self.weight = self.weight - entry.weight
+   end
+end
+
+--- Store an entry as the most recently used one, evicting others if the cache is over capacity.
+-- Values heavier than the whole cache are not stored.
+-- @param key Key.
+-- @param[opt] subkey Second part of the key.
+-- @param value Value to store.
+-- @tparam[opt=1] number weight Weight of the entry counted against the capacity.
+function lru:set (key, subkey, value, weight)
+   weight = weight or 1
+   self:remove(key, subkey)
+   if weight > self.capacity then
+      return
+   end
+   subkey = subkey == nil and true or subkey
+   local bucket = self._map[key]
+   if not bucket then
+      bucket = {}
+      self._map[key] = bucket
+   end
+   local entry = { key = key, subkey = subkey, value = value, weight = weight }
+   bucket[subkey] = entry
+   pushFront(self._head, entry)
+   self.count = self.count + 1
+   self.weight = self.weight + weight
+   while self.weight > self.capacity do
+      local victim = self._head.prev
+      self:remove(victim.key, victim.subkey)
+      self.evictions = self.evictions + 1
+   end
+end
+
+--- Change the capacity, evicting entries as necessary.
+-- @tparam number capacity Maximum total weight of the entries kept.
+function lru:resize (capacity)
+   self.capacity = capacity
+   while self.weight > self.capacity do
+      local victim = self._head.prev
+      self:remove(victim.key, victim.subkey)
+      self.evictions = self.evictions + 1
+   end
+end
+
+--- Iterate over the entries from the least to the most recently used, without changing their order.
+-- @treturn function Iterator returning the key, subkey and value of each entry.
+function lru:entries ()
+   local entry = self._head
+   return function ()
+      entry = entry.prev
+      if entry ~= self._head then
+         return entry.key, entry.subkey ~= true and entry.subkey or nil, entry.value
+      end
+   end
+end
+
+--- Summarize the cache statistics in a human readable string.
+-- @treturn string
+function lru:stats ()
+   local lookups = self.hits + self.misses
+   return ("%d entries (weight %d of %s), %d hits, %d misses (%.1f%% hit rate), %d evictions"):format(
+      self.count,
+      self.weight,
+      tostring(self.capacity),
+      self.hits,
+      self.misses,
+      lookups > 0 and 100 * self.hits / lookups or 0,
+      self.evictions
+   )
+end
+
+return lru
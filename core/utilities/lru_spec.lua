@@ -0,0 +1,58 @@
+SILE = require("core.sile")
+
+describe("SILE.utilities.lru", function ()
+   it("should return stored values", function ()
+      local cache = SU.lru(10)
+      cache:set("font", "word", "shaped")
+      assert.is.equal("shaped", cache:get("font", "word"))
+      assert.is.falsy(cache:get("font", "other"))
+      assert.is.equal(1, cache.hits)
+      assert.is.equal(1, cache.misses)
+   end)
+
+   it("should evict the least recently used entries", function ()
+      local cache = SU.lru(3)
+      cache:set("a", nil, 1)
+      cache:set("b", nil, 2)
+      cache:set("c", nil, 3)
+      cache:get("a")
+      cache:set("d", nil, 4)
+      assert.is.equal(1, cache:get("a"))
+      assert.is.falsy(cache:get("b"))
+      assert.is.equal(1, cache.evictions)
+      assert.is.equal(3, cache.count)
+   end)
+
+   it("should count weights against the capacity", function ()
+      local cache = SU.lru(10)
+      cache:set("a", nil, 1, 6)
+      cache:set("b", nil, 2, 6)
+      assert.is.falsy(cache:get("a"))
+      assert.is.equal(6, cache.weight)
+      cache:set("c", nil, 3, 11)
+      assert.is.falsy(cache:get("c"))
+      assert.is.equal(2, cache:get("b"))
+   end)
+
+   it("should replace existing entries", function ()
+      local cache = SU.lru(10)
+      cache:set("a", "x", 1, 4)
+      cache:set("a", "x", 2, 5)
+      assert.is.equal(2, cache:get("a", "x"))
+      assert.is.equal(1, cache.count)
+      assert.is.equal(5, cache.weight)
+   end)
+
+   it("should iterate from the least recently used entry", function ()
+      local cache = SU.lru(10)
+      cache:set("a", nil, 1)
+      cache:set("b", "x", 2)
+      cache:set("c", nil, 3)
+      cache:get("a")
+      local seen = {}
+      for key, subkey, value in cache:entries() do
+         seen[#seen + 1] = { key, subkey, value }
+      end
+      assert.is.same({ { "b", "x", 2 }, { "c", nil, 3 }, { "a", nil, 1 } }, seen)
+   end)
+end)
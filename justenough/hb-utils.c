@@ -5,6 +5,88 @@
 #include "hb-utils.h"
 #include "silewin32.h"
 
+/* #define COMPAT53_PREFIX compat53 */
+#include "compat-5.3.h"
+
+#define HBFONT_MT "justenough.hbfont"
+
+/* Registry of faces shared between font instances.
+
+Every distinct set of font options (size, weight, variations, ...) gets its
+own hb_font_t, but they all sit on top of a single hb_face_t (and so a single
+blob of font data) per file and face index. Entries are reference counted by
+the fonts using them and dropped when the last one is collected. */
+
+typedef struct face_entry {
+  struct face_entry* next;
+  char* filename;
+  int index;
+  hb_face_t* face;
+  unsigned int refs;
+} face_entry;
+
+/* The userdata stored as the face table's hbFont field. The release function
+is kept in the handle because this file is linked into more than one module,
+each with its own registry, while the metatable is shared between them. */
+typedef struct {
+  hb_font_t* font;
+  face_entry* entry;
+  void (*release)(face_entry*);
+} font_handle;
+
+static face_entry* face_registry = NULL;
+
+static face_entry* acquire_face(const char* filename, int face_index) {
+  face_entry* entry;
+  hb_blob_t* blob;
+
+  for (entry = face_registry; entry; entry = entry->next) {
+    if (entry->index == face_index && !strcmp(entry->filename, filename)) {
+      entry->refs++;
+      return entry;
+    }
+  }
+
+  blob = hb_blob_create_from_file(filename);
+  entry = malloc(sizeof(face_entry));
+  entry->filename = strdup(filename);
+  entry->index = face_index;
+  entry->face = hb_face_create(blob, face_index);
+  entry->refs = 1;
+  entry->next = face_registry;
+  face_registry = entry;
+  hb_blob_destroy(blob); /* The face holds its own reference */
+  return entry;
+}
+
+static void release_face(face_entry* entry) {
+  face_entry** link;
+
+  if (--entry->refs > 0)
+    return;
+
+  for (link = &face_registry; *link; link = &(*link)->next) {
+    if (*link == entry) {
+      *link = entry->next;
+      break;
+    }
+  }
+  hb_face_destroy(entry->face);
+  free(entry->filename);
+  free(entry);
+}
+
+static int font_handle_gc(lua_State *L) {
+  font_handle* handle = (font_handle*)lua_touserdata(L, 1);
+  if (handle && handle->font) {
+    hb_font_destroy(handle->font);
+    handle->release(handle->entry);
+    handle->font = NULL;
+    handle->entry = NULL;
+  }
+  return 0;
+}
+
 static hb_variation_t* scan_variation_string(const char* cp1, unsigned int* ret) {
   hb_variation_t* variations = NULL;
   hb_variation_t variation;
@@ -40,15 +122,17 @@ static hb_variation_t* scan_variation_string(const char* cp1, unsigned int* ret)
 hb_font_t* get_hb_font(lua_State *L, int index) {
   const char * filename;
   int face_index = 0;
-  hb_blob_t* blob;
+  face_entry* entry;
   hb_face_t* face;
   hb_font_t* font;
+  font_handle* handle;
   unsigned int upem;
 
   luaL_checktype(L, index, LUA_TTABLE);
 
   lua_getfield(L, index, "hbFont");
-  if (lua_islightuserdata(L, -1)) { return lua_touserdata(L, -1); }
+  handle = (font_handle*)luaL_testudata(L, -1, HBFONT_MT);
+  if (handle && handle->font) { return handle->font; }
 
   lua_getfield(L, index, "filename");
   filename = luaL_checkstring(L, -1);
@@ -56,8 +140,8 @@ hb_font_t* get_hb_font(lua_State *L, int index) {
   lua_getfield(L, index, "index");
   if (lua_isnumber(L, -1)) { face_index = lua_tointeger(L, -1); }
 
-  blob = hb_blob_create_from_file(filename);
-  face = hb_face_create(blob, face_index);
+  entry = acquire_face(filename, face_index);
+  face = entry->face;
   font = hb_font_create(face);
   upem = hb_face_get_upem(face);
   hb_font_set_scale(font, upem, upem);
@@ -139,10 +223,15 @@ hb_font_t* get_hb_font(lua_State *L, int index) {
   }
 #endif
 
-  hb_face_destroy(face);
-  hb_blob_destroy(blob);
-
-  lua_pushlightuserdata(L, font);
+  handle = (font_handle*)lua_newuserdata(L, sizeof(font_handle));
+  handle->font = font;
+  handle->entry = entry;
+  handle->release = release_face;
+  if (luaL_newmetatable(L, HBFONT_MT)) {
+    lua_pushcfunction(L, font_handle_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
   lua_setfield(L, index, "hbFont");
 
   return font;
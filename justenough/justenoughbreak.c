@@ -0,0 +1,750 @@
+/* Native kernels for the paragraph builder in core/break.lua.
+ *
+ * The Lua line breaker walks a list of node objects, keeping its widths in
+ * SILE.types.length objects and its active list in a ring of Lua tables. For
+ * the common case (horizontal lists without alternatives or paragraph shapes)
+ * core/break.lua instead flattens the node list into an array of plain
+ * numbers once per pass and hands it to knuthplass() below, which runs the
+ * same algorithm (TeX §§ 855-899, with the same departures from TeX as the
+ * Lua code) over C doubles and an arena of active and delta nodes. */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+/* #define COMPAT53_PREFIX compat53 */
+#include "compat-5.3.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#define KP_THREADS
+#define MAX_THREADS 64
+#endif
+
+#define AWFUL_BAD 1073741823.0
+#define INF_BAD 10000.0
+#define EJECT_PENALTY (-INF_BAD)
+
+/* Node kinds, as flattened by core/break.lua */
+enum {
+  KIND_BOX = 0,
+  KIND_GLUE = 1,
+  KIND_KERN = 2,
+  KIND_DISCRETIONARY = 3,
+  KIND_PENALTY = 4,
+  KIND_OTHER = 5
+};
+
+/* Record layout: kind, advance (width, stretch, shrink), width subtracted
+ * when skipping discardable nodes after a break (width, stretch, shrink),
+ * and either the penalty (of penalties and glues) or the index of the
+ * discretionary's widths. */
+#define RECORD_STRIDE 8
+/* Discretionary layout: prebreak, postbreak and replacement widths */
+#define DISCRETIONARY_STRIDE 9
+
+enum { PASS_OUT_OF_MEMORY = -1, PASS_FAILED = 0, PASS_FOUND = 1 };
+enum { FIT_TIGHT = 0, FIT_DECENT = 1, FIT_LOOSE = 2, FIT_VERY_LOOSE = 3, FIT_CLASSES = 4 };
+enum { ACTIVE_HYPHENATED, ACTIVE_UNHYPHENATED, ACTIVE_DELTA };
+
+typedef struct { double w, st, sh; } kp_width;
+
+typedef struct {
+  int kind;
+  kp_width advance;
+  kp_width skip;
+  double extra;
+} kp_record;
+
+typedef struct {
+  kp_width prebreak, postbreak, replacement;
+} kp_discretionary;
+
+typedef struct {
+  int type;
+  int next;
+  int cur_break;
+  int prev_break;
+  int line_number;
+  int sentinel;
+  double total_demerits;
+  kp_width width; /* delta nodes */
+} kp_active;
+
+typedef struct {
+  double minimal_demerits;
+  int node;
+  int line;
+} kp_best;
+
+typedef struct {
+  /* Input */
+  const kp_record* records;
+  const kp_discretionary* discretionaries;
+  int count;
+  kp_width background;
+  double threshold;
+  int finalpass;
+  double first_width, second_width;
+  int easy_line, last_special_line;
+  double line_penalty, hyphen_penalty, double_hyphen_demerits, adjdemerits;
+  int prev_graf;
+
+  /* Arena of active, passive and delta nodes; links are indices into it */
+  kp_active* arena;
+  int used, capacity;
+
+  /* Scores of the active nodes against the current break, in list order */
+  double* scores; /* Single allocation backing the arrays below */
+  double *shortfall, *stretch, *shrink, *previous, *badness_of, *demerits_of;
+  int scored, next_score, scores_capacity;
+
+  /* Pass state, named after the fields of the Lua line breaker */
+  kp_width active_width, cur_active_width, break_width;
+  kp_best best_in_class[FIT_CLASSES];
+  double minimum_demerits;
+  double line_width;
+  double badness;
+  int fit_class;
+  int artificial_demerits;
+  int no_break_yet;
+  int prev_prev_r, prev_r, r, old_l;
+  int place;
+
+  /* Output */
+  int status;
+  int best;
+} kp_state;
+
+#define HEAD 0
+
+static void width_add(kp_width* a, const kp_width* b) {
+  a->w += b->w;
+  a->st += b->st;
+  a->sh += b->sh;
+}
+
+static void width_sub(kp_width* a, const kp_width* b) {
+  a->w -= b->w;
+  a->st -= b->st;
+  a->sh -= b->sh;
+}
+
+static kp_width width_minus(const kp_width* a, const kp_width* b) {
+  kp_width result;
+  result.w = a->w - b->w;
+  result.st = a->st - b->st;
+  result.sh = a->sh - b->sh;
+  return result;
+}
+
+/* Returns -1 if the arena cannot grow */
+static int new_node(kp_state* s, int type, int next) {
+  kp_active* node;
+  if (s->used == s->capacity) {
+    int capacity = s->capacity ? s->capacity * 2 : 64;
+    kp_active* arena = realloc(s->arena, (size_t)capacity * sizeof(kp_active));
+    if (!arena) return -1;
+    s->arena = arena;
+    s->capacity = capacity;
+  }
+  node = &s->arena[s->used];
+  memset(node, 0, sizeof(kp_active));
+  node->type = type;
+  node->next = next;
+  node->prev_break = -1;
+  return s->used++;
+}
+
+static int is_box(const kp_state* s, int place) {
+  return place >= 1 && place <= s->count && s->records[place - 1].kind == KIND_BOX;
+}
+
+/* Same as SU.rateBadness */
+static double rate_badness(double shortfall, double spring) {
+  double bad;
+  if (spring == 0) return INF_BAD;
+  bad = floor(100 * pow(fabs(shortfall / spring), 3));
+  return bad < INF_BAD ? bad : INF_BAD;
+}
+
+static int create_new_active_nodes(kp_state* s, int break_type) { /* 862 */
+  kp_active* A;
+  int i, node;
+  if (s->no_break_yet) { /* 863 */
+    int place = s->place;
+    s->no_break_yet = 0;
+    s->break_width = s->background;
+    if (place <= s->count && s->records[place - 1].kind == KIND_DISCRETIONARY) { /* 866 */
+      const kp_discretionary* d = &s->discretionaries[(int)s->records[place - 1].extra];
+      width_add(&s->break_width, &d->prebreak);
+      width_add(&s->break_width, &d->postbreak);
+      width_sub(&s->break_width, &d->replacement);
+    }
+    while (place <= s->count && !is_box(s, place)) {
+      width_sub(&s->break_width, &s->records[place - 1].skip);
+      place++;
+    }
+  }
+  /* 869 */
+  A = s->arena;
+  if (A[s->prev_r].type == ACTIVE_DELTA) {
+    width_sub(&A[s->prev_r].width, &s->cur_active_width);
+    width_add(&A[s->prev_r].width, &s->break_width);
+  } else if (s->prev_r == HEAD) {
+    s->active_width = s->break_width;
+  } else {
+    if ((node = new_node(s, ACTIVE_DELTA, s->r)) < 0) return -1;
+    A = s->arena;
+    A[node].width = width_minus(&s->break_width, &s->cur_active_width);
+    A[s->prev_r].next = node;
+    s->prev_prev_r = s->prev_r;
+    s->prev_r = node;
+  }
+  if (fabs(s->adjdemerits) >= AWFUL_BAD - s->minimum_demerits)
+    s->minimum_demerits = AWFUL_BAD - 1;
+  else
+    s->minimum_demerits += fabs(s->adjdemerits);
+
+  for (i = 0; i < FIT_CLASSES; i++) {
+    kp_best* best = &s->best_in_class[i];
+    if (best->minimal_demerits <= s->minimum_demerits) { /* 871 */
+      if ((node = new_node(s, break_type, s->r)) < 0) return -1;
+      A = s->arena;
+      A[node].cur_break = s->place;
+      A[node].prev_break = best->node;
+      A[node].line_number = best->line + 1;
+      A[node].total_demerits = best->minimal_demerits;
+      A[s->prev_r].next = node;
+      s->prev_r = node;
+    }
+    best->minimal_demerits = AWFUL_BAD;
+    best->node = -1;
+    best->line = 0;
+  }
+  s->minimum_demerits = AWFUL_BAD;
+  /* 870 */
+  if (s->r != HEAD) {
+    if ((node = new_node(s, ACTIVE_DELTA, s->r)) < 0) return -1;
+    A = s->arena;
+    A[node].width = width_minus(&s->cur_active_width, &s->break_width);
+    A[s->prev_r].next = node;
+    s->prev_prev_r = s->prev_r;
+    s->prev_r = node;
+  }
+  return 0;
+}
+
+static void deactivate_r(kp_state* s) { /* 886 */
+  kp_active* A = s->arena;
+  A[s->prev_r].next = A[s->r].next;
+  if (s->prev_r == HEAD) { /* 887 */
+    s->r = A[HEAD].next;
+    if (A[s->r].type == ACTIVE_DELTA) {
+      width_add(&s->active_width, &A[s->r].width);
+      s->cur_active_width = s->active_width;
+      A[HEAD].next = A[s->r].next;
+    }
+  } else if (A[s->prev_r].type == ACTIVE_DELTA) {
+    s->r = A[s->prev_r].next;
+    if (s->r == HEAD) {
+      width_sub(&s->cur_active_width, &A[s->prev_r].width);
+      A[s->prev_prev_r].next = HEAD;
+      s->prev_r = s->prev_prev_r;
+    } else if (A[s->r].type == ACTIVE_DELTA) {
+      width_add(&s->cur_active_width, &A[s->r].width);
+      width_add(&A[s->prev_r].width, &A[s->r].width);
+      A[s->prev_r].next = A[s->r].next;
+    }
+  }
+}
+
+/* Returns -1 if the score arrays cannot grow */
+static int reserve_scores(kp_state* s, int count) {
+  int capacity = s->scores_capacity ? s->scores_capacity : 64;
+  double* scores;
+  if (count <= s->scores_capacity) return 0;
+  while (capacity < count) capacity *= 2;
+  scores = realloc(s->scores, (size_t)capacity * 6 * sizeof(double));
+  if (!scores) return -1;
+  s->scores = scores;
+  s->shortfall = scores;
+  s->stretch = scores + capacity;
+  s->shrink = scores + 2 * capacity;
+  s->previous = scores + 3 * capacity;
+  s->badness_of = scores + 4 * capacity;
+  s->demerits_of = scores + 5 * capacity;
+  s->scores_capacity = capacity;
+  return 0;
+}
+
+/* Computes the badness and demerits of every active node against the
+ * current break in one sweep over plain arrays; the fitness class follows
+ * from the badness and the sign of the shortfall. */
+static void rate_scores(kp_state* s, int n, double pi) {
+  double line_penalty = s->line_penalty;
+  double penalty = pi > 0 ? pi * pi : pi > EJECT_PENALTY ? -pi * pi : 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    double shortfall = s->shortfall[i], bad, demerit;
+    if (shortfall > 0)
+      bad = shortfall > 110 && s->stretch[i] < 25 ? INF_BAD : rate_badness(shortfall, s->stretch[i]);
+    else
+      bad = -shortfall > s->shrink[i] ? INF_BAD + 1 : rate_badness(-shortfall, s->shrink[i]);
+    demerit = line_penalty + bad;
+    demerit = fabs(demerit) >= 10000 ? 100000000 : demerit * demerit;
+    s->badness_of[i] = bad;
+    s->demerits_of[i] = demerit + penalty;
+  }
+}
+
+/* Scores the active nodes before try_break() updates the list. Neither
+ * deltas nor deactivations change the widths later active nodes see, and
+ * new active nodes are only inserted behind the walk, so the walk takes the
+ * scores in list order. Returns -1 if out of memory. */
+static int score_active_nodes(kp_state* s, double pi) {
+  kp_active* A = s->arena;
+  kp_width width = s->active_width;
+  int n = 0, r;
+  for (r = A[HEAD].next; r != HEAD; r = A[r].next) {
+    double line_width;
+    if (A[r].type == ACTIVE_DELTA) {
+      width_add(&width, &A[r].width);
+      continue;
+    }
+    if (n >= s->scores_capacity && reserve_scores(s, n + 1) < 0) return -1;
+    line_width = A[r].line_number > s->easy_line || A[r].line_number > s->last_special_line
+                   ? s->second_width : s->first_width;
+    s->shortfall[n] = line_width - width.w;
+    s->stretch[n] = width.st;
+    s->shrink[n] = width.sh;
+    s->previous[n] = A[r].total_demerits;
+    n++;
+  }
+  rate_scores(s, n, pi);
+  s->scored = n;
+  s->next_score = 0;
+  return 0;
+}
+
+static void record_feasible(kp_state* s, int score, int break_type) { /* 881 */
+  kp_active* r = &s->arena[s->r];
+  double demerit = 0;
+  kp_best* best = &s->best_in_class[s->fit_class];
+  if (!s->artificial_demerits) {
+    demerit = s->demerits_of[score];
+    /* We only ever try breaks at existing nodes, so this is never the final
+     * hyphen of the paragraph */
+    if (break_type == ACTIVE_HYPHENATED && r->type == ACTIVE_HYPHENATED)
+      demerit += s->double_hyphen_demerits;
+  }
+  demerit += s->previous[score];
+  if (demerit <= best->minimal_demerits) {
+    best->minimal_demerits = demerit;
+    best->node = r->sentinel ? -1 : s->r;
+    best->line = r->line_number;
+    if (demerit < s->minimum_demerits)
+      s->minimum_demerits = demerit;
+  }
+}
+
+static void consider_demerits(kp_state* s, double pi, int break_type) { /* 877 */
+  int node_stays_active = 0;
+  int score = s->next_score++;
+  s->artificial_demerits = 0;
+  s->badness = s->badness_of[score];
+  if (s->shortfall[score] > 0)
+    s->fit_class = s->badness > 99 ? FIT_VERY_LOOSE : s->badness > 12 ? FIT_LOOSE : FIT_DECENT;
+  else
+    s->fit_class = s->badness > 12 ? FIT_TIGHT : FIT_DECENT;
+  if (s->badness > INF_BAD || pi == EJECT_PENALTY) {
+    if (s->finalpass && s->minimum_demerits == AWFUL_BAD &&
+        s->arena[s->r].next == HEAD && s->prev_r == HEAD) {
+      s->artificial_demerits = 1;
+    } else if (s->badness > s->threshold) {
+      deactivate_r(s);
+      return;
+    }
+  } else {
+    s->prev_r = s->r;
+    if (s->badness > s->threshold) return;
+    node_stays_active = 1;
+  }
+  record_feasible(s, score, break_type);
+  if (!node_stays_active)
+    deactivate_r(s);
+}
+
+static int try_break(kp_state* s, double pi, int break_type) { /* 855 */
+  if (score_active_nodes(s, pi) < 0) return -1;
+  s->no_break_yet = 1;
+  s->prev_prev_r = -1;
+  s->prev_r = HEAD;
+  s->old_l = 0;
+  s->cur_active_width = s->active_width;
+  for (;;) {
+    kp_active* r;
+    s->r = s->arena[s->prev_r].next;
+    r = &s->arena[s->r];
+    if (r->type == ACTIVE_DELTA) { /* 858 */
+      width_add(&s->cur_active_width, &r->width);
+      s->prev_prev_r = s->prev_r;
+      s->prev_r = s->r;
+      continue;
+    }
+    if (r->line_number > s->old_l) { /* 861 */
+      int line_number = r->line_number;
+      if (s->minimum_demerits < AWFUL_BAD && (s->old_l != s->easy_line || s->r == HEAD))
+        if (create_new_active_nodes(s, break_type) < 0) return -1;
+      if (s->r == HEAD) return 0;
+      /* 876 */
+      if (line_number > s->easy_line) {
+        s->line_width = s->second_width;
+        s->old_l = (int)AWFUL_BAD - 1;
+      } else {
+        s->old_l = line_number;
+        s->line_width = line_number > s->last_special_line ? s->second_width : s->first_width;
+      }
+    }
+    consider_demerits(s, pi, break_type);
+  }
+}
+
+static int check_for_legal_break(kp_state* s) { /* 892 */
+  const kp_record* node = &s->records[s->place - 1];
+  switch (node->kind) {
+  case KIND_BOX:
+  case KIND_KERN:
+    width_add(&s->active_width, &node->advance);
+    break;
+  case KIND_GLUE: /* 894 */
+    if (is_box(s, s->place - 1))
+      if (try_break(s, node->extra, ACTIVE_UNHYPHENATED) < 0) return -1;
+    width_add(&s->active_width, &node->advance);
+    break;
+  case KIND_DISCRETIONARY: { /* 895 */
+    const kp_discretionary* d = &s->discretionaries[(int)node->extra];
+    width_add(&s->active_width, &d->prebreak);
+    if (try_break(s, s->hyphen_penalty, ACTIVE_HYPHENATED) < 0) return -1;
+    width_sub(&s->active_width, &d->prebreak);
+    width_add(&s->active_width, &d->replacement);
+    break;
+  }
+  case KIND_PENALTY:
+    if (try_break(s, node->extra, ACTIVE_UNHYPHENATED) < 0) return -1;
+    break;
+  }
+  return 0;
+}
+
+/* Returns the best final active node, -1 if none has finite demerits, or -2
+ * if the active list is empty (no feasible breaks in this pass). */
+static int try_final_break(kp_state* s) { /* 899 */
+  double fewest_demerits = AWFUL_BAD;
+  int best = -1;
+  int r = s->arena[HEAD].next;
+  if (r == HEAD) return -2;
+  do {
+    if (s->arena[r].type != ACTIVE_DELTA && s->arena[r].total_demerits < fewest_demerits) {
+      fewest_demerits = s->arena[r].total_demerits;
+      best = r;
+    }
+    r = s->arena[r].next;
+  } while (r != HEAD);
+  return best;
+}
+
+static double number_field(lua_State* L, int idx, const char* field, double fallback) {
+  double value;
+  lua_getfield(L, idx, field);
+  value = lua_isnumber(L, -1) ? lua_tonumber(L, -1) : fallback;
+  lua_pop(L, 1);
+  return value;
+}
+
+static void read_width(lua_State* L, int idx, lua_Integer base, kp_width* width) {
+  lua_rawgeti(L, idx, base);
+  lua_rawgeti(L, idx, base + 1);
+  lua_rawgeti(L, idx, base + 2);
+  width->w = lua_tonumber(L, -3);
+  width->st = lua_tonumber(L, -2);
+  width->sh = lua_tonumber(L, -1);
+  lua_pop(L, 3);
+}
+
+static void read_params(lua_State* L, int idx, kp_state* s) {
+  s->threshold = number_field(L, idx, "threshold", INF_BAD);
+  lua_getfield(L, idx, "finalpass");
+  s->finalpass = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  s->background.w = number_field(L, idx, "background", 0);
+  s->background.st = number_field(L, idx, "backgroundStretch", 0);
+  s->background.sh = number_field(L, idx, "backgroundShrink", 0);
+  s->second_width = number_field(L, idx, "secondWidth", 0);
+  s->first_width = number_field(L, idx, "firstWidth", s->second_width);
+  s->easy_line = (int)number_field(L, idx, "easyLine", 0);
+  s->last_special_line = (int)number_field(L, idx, "lastSpecialLine", 0);
+  s->line_penalty = number_field(L, idx, "linePenalty", 10);
+  s->hyphen_penalty = number_field(L, idx, "hyphenPenalty", 50);
+  s->double_hyphen_demerits = number_field(L, idx, "doubleHyphenDemerits", 10000);
+  s->adjdemerits = number_field(L, idx, "adjdemerits", 10000);
+  s->prev_graf = (int)number_field(L, idx, "prevGraf", 0);
+}
+
+/* Reads the flattened records and discretionaries into userdata left on the
+ * stack, so that they are collected if anything errors and stay alive while
+ * the pass runs. */
+static void read_nodes(lua_State* L, int ridx, int didx, kp_state* s) {
+  kp_record* records;
+  kp_discretionary* discretionaries = NULL;
+  lua_Integer i, count, ndiscretionaries;
+
+  count = luaL_len(L, ridx) / RECORD_STRIDE;
+  ndiscretionaries = luaL_len(L, didx) / DISCRETIONARY_STRIDE;
+  luaL_argcheck(L, count < 0x7fffffff, ridx, "too many nodes");
+
+  records = (kp_record*)lua_newuserdata(L, (size_t)(count + 1) * sizeof(kp_record));
+  for (i = 0; i < count; i++) {
+    lua_Integer base = i * RECORD_STRIDE + 1;
+    lua_rawgeti(L, ridx, base);
+    records[i].kind = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    read_width(L, ridx, base + 1, &records[i].advance);
+    read_width(L, ridx, base + 4, &records[i].skip);
+    lua_rawgeti(L, ridx, base + 7);
+    records[i].extra = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (records[i].kind == KIND_DISCRETIONARY &&
+        (records[i].extra < 0 || records[i].extra >= (double)ndiscretionaries))
+      luaL_argerror(L, didx, "discretionary out of range");
+  }
+  if (ndiscretionaries > 0) {
+    discretionaries = (kp_discretionary*)lua_newuserdata(L, (size_t)ndiscretionaries * sizeof(kp_discretionary));
+    for (i = 0; i < ndiscretionaries; i++) {
+      lua_Integer base = i * DISCRETIONARY_STRIDE + 1;
+      read_width(L, didx, base, &discretionaries[i].prebreak);
+      read_width(L, didx, base + 3, &discretionaries[i].postbreak);
+      read_width(L, didx, base + 6, &discretionaries[i].replacement);
+    }
+  }
+  s->records = records;
+  s->discretionaries = discretionaries;
+  s->count = (int)count;
+}
+
+/* Runs a pass without touching the Lua state, so that it can run on a worker
+ * thread. Sets status and best. */
+static void run_pass(kp_state* s) {
+  int i, node;
+  /* 890 */
+  for (i = 0; i < FIT_CLASSES; i++) {
+    s->best_in_class[i].minimal_demerits = AWFUL_BAD;
+    s->best_in_class[i].node = -1;
+  }
+  s->minimum_demerits = AWFUL_BAD;
+  if (new_node(s, ACTIVE_HYPHENATED, HEAD) < 0 || (node = new_node(s, ACTIVE_UNHYPHENATED, HEAD)) < 0) {
+    s->status = PASS_OUT_OF_MEMORY;
+    return;
+  }
+  s->arena[HEAD].line_number = (int)AWFUL_BAD;
+  s->arena[HEAD].sentinel = 1;
+  s->arena[HEAD].next = node;
+  s->arena[node].line_number = s->prev_graf + 1;
+  s->arena[node].sentinel = 1;
+  s->active_width = s->background;
+
+  for (s->place = 1; s->place <= s->count && s->arena[HEAD].next != HEAD; s->place++) {
+    if (check_for_legal_break(s) < 0) {
+      s->status = PASS_OUT_OF_MEMORY;
+      return;
+    }
+  }
+  if (s->place <= s->count || (s->best = try_final_break(s)) == -2)
+    s->status = PASS_FAILED;
+  else
+    s->status = PASS_FOUND;
+}
+
+static void free_pass(kp_state* s) {
+  free(s->arena);
+  free(s->scores);
+  s->arena = NULL;
+  s->scores = NULL;
+}
+
+/* Pushes the results of a pass and frees its arena */
+static int push_result(lua_State* L, kp_state* s) {
+  int n, node, results;
+  if (s->status == PASS_OUT_OF_MEMORY) {
+    free_pass(s);
+    return luaL_error(L, "Out of memory in line breaker");
+  }
+  if (s->status == PASS_FAILED) {
+    lua_pushboolean(L, 0);
+    lua_pushinteger(L, s->place);
+    results = 2;
+  } else if (s->best < 0) {
+    lua_pushboolean(L, 1);
+    results = 1;
+  } else if (s->arena[s->best].sentinel) {
+    /* The initial active node ends no line */
+    lua_pushboolean(L, 1);
+    lua_newtable(L);
+    results = 2;
+  } else {
+    lua_pushboolean(L, 1);
+    for (n = 0, node = s->best; node >= 0; node = s->arena[node].prev_break)
+      n++;
+    lua_createtable(L, n, 0);
+    for (node = s->best; node >= 0; node = s->arena[node].prev_break) {
+      lua_pushinteger(L, s->arena[node].cur_break);
+      lua_rawseti(L, -2, n--);
+    }
+    results = 2;
+  }
+  free_pass(s);
+  return results;
+}
+
+/* knuthplass(records, discretionaries, params)
+ *
+ * Runs one pass of the line breaker. Returns false if no active node
+ * survived to the end of the paragraph, followed by the place after the node
+ * at which the last one was deactivated; otherwise true, followed by the
+ * list of break positions (1-based node indices, first line first) of the
+ * best final node, if one has finite demerits. */
+int je_break_knuthplass(lua_State* L) {
+  kp_state s;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  memset(&s, 0, sizeof(kp_state));
+  read_params(L, 3, &s);
+  read_nodes(L, 1, 2, &s);
+  run_pass(&s);
+  return push_result(L, &s);
+}
+
+#ifdef KP_THREADS
+typedef struct {
+  kp_state* states;
+  int count, first, stride;
+} kp_worker;
+
+static void* run_worker(void* arg) {
+  kp_worker* worker = (kp_worker*)arg;
+  int i;
+  for (i = worker->first; i < worker->count; i += worker->stride)
+    run_pass(&worker->states[i]);
+  return NULL;
+}
+#endif
+
+/* Runs the passes on up to threads threads, the calling one included */
+static void run_passes(kp_state* states, int count, int threads) {
+#ifdef KP_THREADS
+  pthread_t ids[MAX_THREADS];
+  kp_worker workers[MAX_THREADS];
+  int started[MAX_THREADS];
+  int t;
+  if (threads > count) threads = count;
+  if (threads > MAX_THREADS) threads = MAX_THREADS;
+  if (threads > 1) {
+    for (t = 0; t < threads; t++) {
+      workers[t].states = states;
+      workers[t].count = count;
+      workers[t].first = t;
+      workers[t].stride = threads;
+      started[t] = t > 0 && pthread_create(&ids[t], NULL, run_worker, &workers[t]) == 0;
+    }
+    run_worker(&workers[0]);
+    for (t = 1; t < threads; t++) {
+      if (started[t])
+        pthread_join(ids[t], NULL);
+      else
+        run_worker(&workers[t]);
+    }
+    return;
+  }
+#else
+  (void)threads;
+#endif
+  {
+    int i;
+    for (i = 0; i < count; i++)
+      run_pass(&states[i]);
+  }
+}
+
+/* knuthplass_batch(jobs, threads)
+ *
+ * Runs independent passes, each job being a table holding the arguments of
+ * knuthplass(), on up to threads native threads. Returns a list with the
+ * results of each job packed in a table. */
+int je_break_knuthplass_batch(lua_State* L) {
+  kp_state* states;
+  lua_Integer i, count;
+  int threads, top, results, buffer, buffers = 0;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  threads = (int)luaL_optinteger(L, 2, 1);
+  count = luaL_len(L, 1);
+  luaL_argcheck(L, count < 0x7fff, 1, "too many jobs");
+  lua_settop(L, 2);
+  states = (kp_state*)lua_newuserdata(L, (size_t)(count + 1) * sizeof(kp_state)); /* index 3 */
+  memset(states, 0, (size_t)(count + 1) * sizeof(kp_state));
+  /* The node buffers of every job are kept alive in one table, so that the
+   * stack does not grow with the number of jobs */
+  lua_createtable(L, (int)count * 2, 0); /* index 4 */
+  top = lua_gettop(L) + 1;
+  for (i = 0; i < count; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    luaL_checktype(L, top, LUA_TTABLE);
+    lua_rawgeti(L, top, 1);
+    lua_rawgeti(L, top, 2);
+    lua_rawgeti(L, top, 3);
+    luaL_checktype(L, top + 1, LUA_TTABLE);
+    luaL_checktype(L, top + 2, LUA_TTABLE);
+    luaL_checktype(L, top + 3, LUA_TTABLE);
+    read_params(L, top + 3, &states[i]);
+    read_nodes(L, top + 1, top + 2, &states[i]);
+    for (buffer = top + 4; buffer <= lua_gettop(L); buffer++) {
+      lua_pushvalue(L, buffer);
+      lua_rawseti(L, top - 1, ++buffers);
+    }
+    lua_settop(L, top - 1);
+  }
+  run_passes(states, (int)count, threads);
+  for (i = 0; i < count; i++) {
+    if (states[i].status == PASS_OUT_OF_MEMORY) {
+      for (i = 0; i < count; i++)
+        free_pass(&states[i]);
+      return luaL_error(L, "Out of memory in line breaker");
+    }
+  }
+  lua_createtable(L, (int)count, 0);
+  for (i = 0; i < count; i++) {
+    lua_newtable(L);
+    results = push_result(L, &states[i]);
+    for (; results > 0; results--)
+      lua_rawseti(L, -1 - results, results);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+static const struct luaL_Reg lib_table [] = {
+  {"knuthplass", je_break_knuthplass},
+  {"knuthplass_batch", je_break_knuthplass_batch},
+  {NULL, NULL}
+};
+
+int luaopen_justenoughbreak (lua_State *L) {
+  lua_newtable(L);
+  luaL_setfuncs(L, lib_table, 0);
+  return 1;
+}
@@ -1,5 +1,10 @@
 #define _GNU_SOURCE
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <fontconfig/fontconfig.h>
 
@@ -12,11 +17,118 @@
 // #define COMPAT53_PREFIX compat53
 #include "compat-5.3.h"
 
+/* Matching a pattern means building it, running config substitutions over it
+ * and scoring every font fontconfig knows about, so results are memoized by
+ * the normalised request. Entries are few (one per distinct font request) and
+ * never evicted. */
+
+#define MATCH_BUCKETS 64
+
+typedef struct match_entry {
+  uint32_t hash;
+  char* key;
+  char* filename;
+  char* family;
+  char* fullname;
+  int index;
+  struct match_entry* next;
+} match_entry;
+
+static match_entry* match_memo[MATCH_BUCKETS];
+
+static uint32_t hash_bytes(uint32_t h, const void* data, size_t len) {
+  const unsigned char* p = (const unsigned char*)data;
+  while (len--) {
+    h ^= *p++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static char* dup_string(const char* s) {
+  char* copy;
+  size_t len;
+  if (!s) return NULL;
+  len = strlen(s) + 1;
+  copy = malloc(len);
+  if (copy) memcpy(copy, s, len);
+  return copy;
+}
+
+/* Family and style names are compared ignoring case and blanks, as
+ * fontconfig itself does. */
+static void normalise_name(char* out, size_t outlen, const char* in) {
+  size_t n = 0;
+  for (; *in && n + 1 < outlen; in++) {
+    if (*in == ' ') continue;
+    out[n++] = (char)tolower((unsigned char)*in);
+  }
+  out[n] = '\0';
+}
+
+static void match_key(char* key, size_t keylen, const char* family, int weight, int slant,
+                      const char* style, double pointSize) {
+  char nfamily[256], nstyle[128];
+  normalise_name(nfamily, sizeof(nfamily), family);
+  normalise_name(nstyle, sizeof(nstyle), style);
+  snprintf(key, keylen, "%s\x1f%d\x1f%d\x1f%s\x1f%g", nfamily, weight, slant, nstyle, pointSize);
+}
+
+static match_entry* match_lookup(const char* key) {
+  uint32_t hash = hash_bytes(2166136261u, key, strlen(key));
+  match_entry* entry;
+  for (entry = match_memo[hash % MATCH_BUCKETS]; entry; entry = entry->next)
+    if (entry->hash == hash && !strcmp(entry->key, key))
+      return entry;
+  return NULL;
+}
+
+static match_entry* match_store(const char* key, const char* filename, int index,
+                                const char* family, const char* fullname) {
+  match_entry* entry = match_lookup(key);
+  uint32_t hash;
+  if (entry) return entry;
+  entry = calloc(1, sizeof(match_entry));
+  if (!entry) return NULL;
+  entry->key = dup_string(key);
+  entry->filename = dup_string(filename);
+  entry->family = dup_string(family);
+  entry->fullname = dup_string(fullname);
+  entry->index = index;
+  if (!entry->key || !entry->filename || !entry->family || (fullname && !entry->fullname)) {
+    free(entry->key);
+    free(entry->filename);
+    free(entry->family);
+    free(entry->fullname);
+    free(entry);
+    return NULL;
+  }
+  hash = hash_bytes(2166136261u, key, strlen(key));
+  entry->hash = hash;
+  entry->next = match_memo[hash % MATCH_BUCKETS];
+  match_memo[hash % MATCH_BUCKETS] = entry;
+  return entry;
+}
+
+static void push_match(lua_State* L, match_entry* entry) {
+  lua_newtable(L);
+  lua_pushstring(L, entry->filename);
+  lua_setfield(L, -2, "filename");
+  lua_pushstring(L, entry->family);
+  lua_setfield(L, -2, "family");
+  if (entry->fullname) {
+    lua_pushstring(L, entry->fullname);
+    lua_setfield(L, -2, "fullname");
+  }
+}
+
 int je_face_from_options(lua_State* L) {
   FcChar8 * font_path, * fullname, * familyname;
   FcPattern* p;
   FcPattern* matched;
   FcResult result;
+  match_entry* entry;
+  char key[512];
   int index = 0;
 
   const char *family = "Gentium";
@@ -92,6 +204,14 @@ int je_face_from_options(lua_State* L) {
   }
   lua_pop(L,1);
 
+  match_key(key, sizeof(key), family, weight, slant, style, pointSize);
+  entry = match_lookup(key);
+  if (entry) {
+    push_match(L, entry);
+    index = entry->index;
+    goto done_match;
+  }
+
   p = FcPatternCreate();
 
   FcPatternAddString (p, FC_FAMILY, (FcChar8*)(family));
@@ -111,41 +231,27 @@ int je_face_from_options(lua_State* L) {
   FcConfigSubstitute (NULL, p, FcMatchFont);
   FcDefaultSubstitute (p);
   matched = FcFontMatch (0, p, &result);
-
-  if (FcPatternGetString (matched, FC_FILE, 0, &font_path) != FcResultMatch)
+  FcPatternDestroy (p);
+  if (!matched)
     return 0;
 
-  FcPatternGetInteger(matched, FC_INDEX, 0, &index);
-  font_path = (FcChar8 *)strdup((char*)font_path);
-  if (!font_path) {
-    printf("Finding font path failed\n");
+  /* Find out which file and family we did actually pick up */
+  if (FcPatternGetString (matched, FC_FILE, 0, &font_path) != FcResultMatch ||
+      FcPatternGetString (matched, FC_FAMILY, 0, &familyname) != FcResultMatch) {
+    FcPatternDestroy (matched);
     return 0;
   }
-  /* Push back slant and weight, we need to pass them to libpdftex */
-  FcPatternGetInteger(matched, FC_SLANT, 0, &slant);
-  FcPatternGetInteger(matched, FC_WEIGHT, 0, &weight);
+  FcPatternGetInteger(matched, FC_INDEX, 0, &index);
+  if (FcPatternGetString (matched, FC_FULLNAME, 0, &fullname) != FcResultMatch)
+    fullname = NULL;
 
-  /* Find out which family we did actually pick up */
-  if (FcPatternGetString (matched, FC_FAMILY, 0, &familyname) != FcResultMatch)
+  entry = match_store(key, (char*)font_path, index, (char*)familyname, (char*)fullname);
+  FcPatternDestroy (matched);
+  if (!entry) {
+    printf("Finding font path failed\n");
     return 0;
-
-  lua_newtable(L);
-  lua_pushstring(L, "filename");
-  lua_pushstring(L, (char*)font_path);
-  lua_settable(L, -3);
-
-  lua_pushstring(L, "family");
-  lua_pushstring(L, (char*)(familyname));
-  lua_settable(L, -3);
-
-  if (FcPatternGetString (matched, FC_FULLNAME, 0, &fullname) == FcResultMatch) {
-    lua_pushstring(L, "fullname");
-    lua_pushstring(L, (char*)(fullname));
-    lua_settable(L, -3);
   }
-
-  FcPatternDestroy (matched);
-  FcPatternDestroy (p);
+  push_match(L, entry);
 
   done_match:
   lua_pushstring(L, "index");
@@ -159,8 +265,93 @@ int je_face_from_options(lua_State* L) {
   return 1;
 }
 
+/* Return every memoized match as a list of {key, filename, index, family,
+ * fullname} tables so that they can be saved between runs. */
+int je_fc_matches(lua_State* L) {
+  lua_Integer n = 0;
+  int b;
+  match_entry* entry;
+  lua_newtable(L);
+  for (b = 0; b < MATCH_BUCKETS; b++) {
+    for (entry = match_memo[b]; entry; entry = entry->next) {
+      push_match(L, entry);
+      lua_pushstring(L, entry->key);
+      lua_setfield(L, -2, "key");
+      lua_pushinteger(L, entry->index);
+      lua_setfield(L, -2, "index");
+      lua_rawseti(L, -2, ++n);
+    }
+  }
+  return 1;
+}
+
+/* Seed the memo with matches saved by a previous run. */
+int je_fc_prime(lua_State* L) {
+  lua_Integer i, n;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  n = luaL_len(L, 1);
+  for (i = 1; i <= n; i++) {
+    const char *key, *filename, *family, *fullname;
+    int index;
+    lua_rawgeti(L, 1, i);
+    lua_getfield(L, -1, "key");
+    lua_getfield(L, -2, "filename");
+    lua_getfield(L, -3, "family");
+    lua_getfield(L, -4, "fullname");
+    lua_getfield(L, -5, "index");
+    key = lua_tostring(L, -5);
+    filename = lua_tostring(L, -4);
+    family = lua_tostring(L, -3);
+    fullname = lua_tostring(L, -2);
+    index = (int)lua_tointeger(L, -1);
+    if (key && filename && family)
+      match_store(key, filename, index, family, fullname);
+    lua_pop(L, 6);
+  }
+  return 0;
+}
+
+static uint32_t stamp_path(uint32_t h, const FcChar8* path) {
+  struct stat st;
+  h = hash_bytes(h, path, strlen((const char*)path) + 1);
+  if (stat((const char*)path, &st) == 0) {
+    long long mtime = (long long)st.st_mtime;
+    h = hash_bytes(h, &mtime, sizeof(mtime));
+  }
+  return h;
+}
+
+/* Fingerprint fontconfig's configuration files and cache directories, whose
+ * modification times change whenever fonts are (re)indexed or the matching
+ * rules change. Only the configuration is loaded, not the fonts. */
+int je_fc_cache_stamp(lua_State* L) {
+  FcConfig* config = FcInitLoadConfig();
+  FcStrList* list;
+  FcChar8* path;
+  uint32_t h = 2166136261u;
+  char buf[32];
+  if (!config) return 0;
+  if ((list = FcConfigGetConfigFiles(config))) {
+    while ((path = FcStrListNext(list)))
+      h = stamp_path(h, path);
+    FcStrListDone(list);
+  }
+  if ((list = FcConfigGetCacheDirs(config))) {
+    while ((path = FcStrListNext(list)))
+      h = stamp_path(h, path);
+    FcStrListDone(list);
+  }
+  FcConfigDestroy(config);
+  snprintf(buf, sizeof(buf), "%d-%08x", FC_VERSION, (unsigned int)h);
+  lua_pushstring(L, buf);
+  return 1;
+}
+
 static const struct luaL_Reg lib_table [] = {
   {"_face", je_face_from_options},
+  {"_matches", je_fc_matches},
+  {"_prime", je_fc_prime},
+  {"_cache_stamp", je_fc_cache_stamp},
   {NULL, NULL}
 };
 
@@ -8,6 +8,12 @@
 #endif
 #include <string.h>
 
+#include <unicode/ubidi.h>
+#include <unicode/ubrk.h>
+#include <unicode/uloc.h>
+#include <unicode/utf8.h>
+#include <unicode/utf16.h>
+
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
@@ -137,8 +143,173 @@ static char** scan_shaper_list(char* cp1) {
   return res;
 }
 
+static hb_direction_t parse_direction(const char* direction_s) {
+  if (!strcasecmp(direction_s,"RTL"))
+    return HB_DIRECTION_RTL;
+  else if (!strcasecmp(direction_s,"TTB"))
+    return HB_DIRECTION_TTB;
+  return HB_DIRECTION_LTR;
+}
+
+/* Parsed feature and shaper list cache.
+
+Documents only ever use a handful of distinct feature and shaper list
+strings, so rather than re-parsing them for every token we intern the
+parsed form here. Entries are owned by the cache; when it fills up it is
+simply flushed and repopulated. */
+
+#define PARSE_CACHE_BUCKETS 64
+#define PARSE_CACHE_MAX_ENTRIES 256
+
+typedef struct parse_cache_entry {
+  struct parse_cache_entry* next;
+  char* key;
+  hb_feature_t* features;
+  int nFeatures;
+  char* shaper_storage; /* Copy of key split in place by scan_shaper_list */
+  char** shapers;
+} parse_cache_entry;
+
+typedef struct {
+  parse_cache_entry* buckets[PARSE_CACHE_BUCKETS];
+  unsigned int count;
+} parse_cache;
+
+static parse_cache feature_cache;
+static parse_cache shaper_list_cache;
+
+static unsigned int hash_string(const char* s) {
+  unsigned int h = 2166136261u; /* FNV-1a */
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void parse_cache_flush(parse_cache* cache) {
+  unsigned int i;
+  for (i = 0; i < PARSE_CACHE_BUCKETS; i++) {
+    parse_cache_entry* entry = cache->buckets[i];
+    while (entry) {
+      parse_cache_entry* next = entry->next;
+      free(entry->key);
+      free(entry->features);
+      free(entry->shaper_storage);
+      free(entry->shapers);
+      free(entry);
+      entry = next;
+    }
+    cache->buckets[i] = NULL;
+  }
+  cache->count = 0;
+}
+
+/* Returns the entry for key, creating an empty one if there is none yet;
+*created is set when the caller needs to fill it in. */
+static parse_cache_entry* parse_cache_lookup(parse_cache* cache, const char* key, int* created) {
+  unsigned int bucket = hash_string(key) % PARSE_CACHE_BUCKETS;
+  parse_cache_entry* entry;
+
+  for (entry = cache->buckets[bucket]; entry; entry = entry->next) {
+    if (!strcmp(entry->key, key)) {
+      *created = 0;
+      return entry;
+    }
+  }
+
+  if (cache->count >= PARSE_CACHE_MAX_ENTRIES)
+    parse_cache_flush(cache);
+
+  entry = calloc(1, sizeof(parse_cache_entry));
+  entry->key = strdup(key);
+  entry->next = cache->buckets[bucket];
+  cache->buckets[bucket] = entry;
+  cache->count++;
+  *created = 1;
+  return entry;
+}
+
+static const hb_feature_t* get_features(const char* featurestring, int* nFeatures) {
+  int created;
+  parse_cache_entry* entry = parse_cache_lookup(&feature_cache, featurestring, &created);
+  if (created)
+    entry->features = scan_feature_string(featurestring, &entry->nFeatures);
+  *nFeatures = entry->nFeatures;
+  return entry->features;
+}
+
+static const char * const* get_shaper_list(const char* shaper_list_string) {
+  int created;
+  parse_cache_entry* entry;
+  if (!*shaper_list_string)
+    return NULL;
+  entry = parse_cache_lookup(&shaper_list_cache, shaper_list_string, &created);
+  if (created) {
+    entry->shaper_storage = strdup(shaper_list_string);
+    entry->shapers = scan_shaper_list(entry->shaper_storage);
+  }
+  return (const char * const*)entry->shapers;
+}
+
+/* Pool of reusable buffers, so that shaping a token does not have to
+allocate and free a buffer (and its internal arrays) every time. */
+
+#define BUFFER_POOL_SIZE 8
+
+static hb_buffer_t* buffer_pool[BUFFER_POOL_SIZE];
+static unsigned int buffer_pool_count = 0;
+
+static hb_buffer_t* acquire_buffer(void) {
+  if (buffer_pool_count > 0)
+    return buffer_pool[--buffer_pool_count];
+  return hb_buffer_create();
+}
+
+static void release_buffer(hb_buffer_t* buf) {
+  if (buffer_pool_count < BUFFER_POOL_SIZE && hb_buffer_allocation_successful(buf)) {
+    hb_buffer_reset(buf);
+    buffer_pool[buffer_pool_count++] = buf;
+  } else {
+    hb_buffer_destroy(buf);
+  }
+}
+
+/* Shape whatever text the caller has added to a pooled buffer. RTL buffers
+are reversed so that glyphs come out in visual order. */
+static void shape_buffer(hb_font_t* hbFont, hb_buffer_t* buf,
+                         const char* script, hb_direction_t direction,
+                         const char* lang, const char* featurestring,
+                         const char* shaper_list_string) {
+  const char * const* shaper_list = get_shaper_list(shaper_list_string);
+  int nFeatures = 0;
+  const hb_feature_t* features = get_features(featurestring, &nFeatures);
+
+  hb_buffer_set_script(buf, hb_tag_from_string(script, strlen(script)));
+  hb_buffer_set_direction(buf, direction);
+  hb_buffer_set_language(buf, hb_language_from_string(lang,strlen(lang)));
+
+  hb_buffer_guess_segment_properties(buf);
+  hb_shape_full (hbFont, buf, features, nFeatures, shaper_list);
+
+  if (direction == HB_DIRECTION_RTL) {
+    hb_buffer_reverse(buf); /* URGH */
+  }
+}
+
+/* Shape a single run of text into a pooled buffer, which the caller must
+hand back with release_buffer(). */
+static hb_buffer_t* shape_text(hb_font_t* hbFont, const char* text, size_t text_l,
+                               const char* script, hb_direction_t direction,
+                               const char* lang, const char* featurestring,
+                               const char* shaper_list_string) {
+  hb_buffer_t *buf = acquire_buffer();
+  hb_buffer_add_utf8(buf, text, text_l, 0, text_l);
+  shape_buffer(hbFont, buf, script, direction, lang, featurestring, shaper_list_string);
+  return buf;
+}
+
 int je_hb_shape (lua_State *L) {
-    size_t font_l;
     const char * text = luaL_checkstring(L, 1);
     hb_font_t * hbFont = get_hb_font(L, 2);
     const char * script = luaL_checkstring(L, 3);
@@ -146,45 +317,20 @@ int je_hb_shape (lua_State *L) {
     const char * lang = luaL_checkstring(L, 5);
     double point_size = luaL_checknumber(L, 6);
     const char * featurestring = luaL_checkstring(L, 7);
-    char * shaper_list_string = (char *)luaL_checkstring(L, 8);
-    const char * const* shaper_list = NULL;
-    if (strlen(shaper_list_string) > 0) {
-      shaper_list = (const char * const*)scan_shaper_list(shaper_list_string);
-    }
+    const char * shaper_list_string = luaL_checkstring(L, 8);
 
-    hb_direction_t direction;
-    hb_feature_t* features;
-    int nFeatures = 0;
+    hb_direction_t direction = parse_direction(direction_s);
     unsigned int glyph_count = 0;
     hb_buffer_t *buf;
     hb_glyph_info_t *glyph_info;
     hb_glyph_position_t *glyph_pos;
     unsigned int j;
 
-    features = scan_feature_string(featurestring, &nFeatures);
-
-    if (!strcasecmp(direction_s,"RTL"))
-      direction = HB_DIRECTION_RTL;
-    else if (!strcasecmp(direction_s,"TTB"))
-      direction = HB_DIRECTION_TTB;
-    else
-      direction = HB_DIRECTION_LTR;
-
     unsigned int upem = hb_face_get_upem(hb_font_get_face(hbFont));
 
-    buf = hb_buffer_create();
-    hb_buffer_add_utf8(buf, text, strlen(text), 0, strlen(text));
-
-    hb_buffer_set_script(buf, hb_tag_from_string(script, strlen(script)));
-    hb_buffer_set_direction(buf, direction);
-    hb_buffer_set_language(buf, hb_language_from_string(lang,strlen(lang)));
+    buf = shape_text(hbFont, text, strlen(text), script, direction, lang,
+                     featurestring, shaper_list_string);
 
-    hb_buffer_guess_segment_properties(buf);
-    int res = hb_shape_full (hbFont, buf, features, nFeatures, shaper_list);
-
-    if (direction == HB_DIRECTION_RTL) {
-      hb_buffer_reverse(buf); /* URGH */
-    }
     glyph_info   = hb_buffer_get_glyph_infos(buf, &glyph_count);
     glyph_pos    = hb_buffer_get_glyph_positions(buf, &glyph_count);
     for (j = 0; j < glyph_count; ++j) {
@@ -274,12 +420,556 @@ int je_hb_shape (lua_State *L) {
       lua_settable(L, -3);
     }
     /* Cleanup */
-    hb_buffer_destroy(buf);
+    release_buffer(buf);
 
-    free(features);
     return glyph_count;
 }
 
+/* Batch shaping.
+
+_shape_batch() takes a list of runs and returns one glyph run userdata per
+run. Each glyph run holds the shaped output as flat arrays (one per field)
+rather than as a table per glyph; the fields are read through accessor
+methods, and glyph names are only looked up on request. */
+
+#define GLYPHRUN_MT "justenoughharfbuzz.glyphrun"
+
+typedef struct {
+  unsigned int count;
+  hb_font_t* font; /* Referenced, so glyph names can be looked up later */
+  double* data; /* Single allocation backing all of the arrays below */
+  double* width;
+  double* glyph_advance;
+  double* height;
+  double* depth;
+  double* x_offset;
+  double* y_offset;
+  double* x_bearing;
+  double* glyph_width;
+  hb_codepoint_t* gid;
+  unsigned int* cluster;
+} glyphrun_t;
+
+#define GLYPHRUN_DOUBLE_FIELDS 8
+
+static glyphrun_t* check_glyphrun(lua_State *L, int index) {
+  return (glyphrun_t*)luaL_checkudata(L, index, GLYPHRUN_MT);
+}
+
+/* Converts a 1-based Lua glyph index into an array offset */
+static unsigned int check_glyph_offset(lua_State *L, glyphrun_t* run, int index) {
+  lua_Integer i = luaL_checkinteger(L, index);
+  luaL_argcheck(L, i >= 1 && i <= (lua_Integer)run->count, index, "glyph index out of range");
+  return (unsigned int)(i - 1);
+}
+
+static const char* run_string_field(lua_State *L, int index, const char* field, const char* fallback) {
+  const char* s;
+  lua_getfield(L, index, field);
+  s = lua_isstring(L, -1) ? lua_tostring(L, -1) : fallback;
+  lua_pop(L, 1);
+  /* Strings stay referenced from the run table, which outlives the call */
+  return s;
+}
+
+/* If cluster_map is given, cluster values are translated through it (e.g.
+from UTF-16 to UTF-8 offsets). Returns 0 if the run could not be allocated. */
+static int fill_glyphrun(glyphrun_t* run, hb_font_t* hbFont, hb_buffer_t* buf,
+                          hb_direction_t direction, double point_size,
+                          const int32_t* cluster_map) {
+  unsigned int glyph_count = 0;
+  hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(buf, &glyph_count);
+  hb_glyph_position_t *glyph_pos = hb_buffer_get_glyph_positions(buf, &glyph_count);
+  unsigned int upem = hb_face_get_upem(hb_font_get_face(hbFont));
+  double scale = point_size / upem;
+  size_t doubles_l = (size_t)glyph_count * GLYPHRUN_DOUBLE_FIELDS * sizeof(double);
+  size_t ints_l = (size_t)glyph_count * (sizeof(hb_codepoint_t) + sizeof(unsigned int));
+  unsigned int j;
+
+  run->font = hb_font_reference(hbFont);
+  run->data = malloc(doubles_l + ints_l + 1);
+  if (!run->data) return 0;
+  run->count = glyph_count;
+  run->width         = run->data;
+  run->glyph_advance = run->width + glyph_count;
+  run->height        = run->glyph_advance + glyph_count;
+  run->depth         = run->height + glyph_count;
+  run->x_offset      = run->depth + glyph_count;
+  run->y_offset      = run->x_offset + glyph_count;
+  run->x_bearing     = run->y_offset + glyph_count;
+  run->glyph_width   = run->x_bearing + glyph_count;
+  run->gid           = (hb_codepoint_t*)(run->glyph_width + glyph_count);
+  run->cluster       = (unsigned int*)(run->gid + glyph_count);
+
+  for (j = 0; j < glyph_count; ++j) {
+    hb_glyph_extents_t extents = {0,0,0,0};
+    hb_font_get_glyph_extents(hbFont, glyph_info[j].codepoint, &extents);
+
+    double height = extents.y_bearing * scale;
+    double tHeight = extents.height * scale;
+    double width = glyph_pos[j].x_advance * scale;
+    double glyphAdvance = hb_font_get_glyph_h_advance(hbFont, glyph_info[j].codepoint) * scale;
+
+    /* See je_hb_shape for why offsets are ignored and advances swapped in TTB */
+    if (direction == HB_DIRECTION_TTB) {
+      height = -glyph_pos[j].y_advance * scale;
+      tHeight = -height;
+      width = glyphAdvance;
+      glyphAdvance = height;
+      run->x_offset[j] = 0;
+      run->y_offset[j] = 0;
+    } else {
+      run->x_offset[j] = glyph_pos[j].x_offset * scale;
+      run->y_offset[j] = glyph_pos[j].y_offset * scale;
+    }
+
+    run->gid[j] = glyph_info[j].codepoint;
+    run->cluster[j] = cluster_map ? (unsigned int)cluster_map[glyph_info[j].cluster] : glyph_info[j].cluster;
+    run->width[j] = width;
+    run->glyph_advance[j] = glyphAdvance;
+    run->height[j] = height;
+    run->depth[j] = -tHeight - height;
+    run->x_bearing[j] = extents.x_bearing * scale;
+    run->glyph_width[j] = extents.width * scale;
+  }
+  return 1;
+}
+
+int je_hb_shape_batch (lua_State *L) {
+  lua_Integer nRuns;
+  lua_Integer i;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  nRuns = luaL_len(L, 1);
+  lua_createtable(L, (int)nRuns, 0);
+  int results = lua_gettop(L);
+
+  for (i = 1; i <= nRuns; i++) {
+    int top = lua_gettop(L);
+    lua_rawgeti(L, 1, i);
+    int runIndex = lua_gettop(L);
+    luaL_argcheck(L, lua_istable(L, runIndex), 1, "each run must be a table");
+
+    size_t text_l;
+    lua_getfield(L, runIndex, "text");
+    const char * text = luaL_checklstring(L, -1, &text_l);
+    lua_getfield(L, runIndex, "face");
+    hb_font_t * hbFont = get_hb_font(L, lua_gettop(L));
+    lua_getfield(L, runIndex, "pointsize");
+    double point_size = luaL_checknumber(L, -1);
+
+    const char * script = run_string_field(L, runIndex, "script", "");
+    const char * lang = run_string_field(L, runIndex, "language", "");
+    const char * featurestring = run_string_field(L, runIndex, "features", "");
+    const char * shaper_list_string = run_string_field(L, runIndex, "shapers", "");
+    hb_direction_t direction = parse_direction(run_string_field(L, runIndex, "direction", "LTR"));
+
+    hb_buffer_t * buf = shape_text(hbFont, text, text_l, script, direction, lang,
+                                   featurestring, shaper_list_string);
+
+    glyphrun_t* run = (glyphrun_t*)lua_newuserdata(L, sizeof(glyphrun_t));
+    memset(run, 0, sizeof(glyphrun_t));
+    luaL_setmetatable(L, GLYPHRUN_MT);
+    if (!fill_glyphrun(run, hbFont, buf, direction, point_size, NULL)) {
+      release_buffer(buf);
+      return luaL_error(L, "Out of memory in shaper");
+    }
+    release_buffer(buf);
+
+    lua_rawseti(L, results, i);
+    lua_settop(L, top);
+  }
+  return 1;
+}
+
+static int glyphrun_gc (lua_State *L) {
+  glyphrun_t* run = check_glyphrun(L, 1);
+  if (run->font) hb_font_destroy(run->font);
+  free(run->data);
+  run->font = NULL;
+  run->data = NULL;
+  run->count = 0;
+  return 0;
+}
+
+static int glyphrun_len (lua_State *L) {
+  lua_pushinteger(L, check_glyphrun(L, 1)->count);
+  return 1;
+}
+
+#define GLYPHRUN_NUMBER_ACCESSOR(name, field) \
+  static int glyphrun_##name (lua_State *L) { \
+    glyphrun_t* run = check_glyphrun(L, 1); \
+    lua_pushnumber(L, run->field[check_glyph_offset(L, run, 2)]); \
+    return 1; \
+  }
+
+#define GLYPHRUN_INTEGER_ACCESSOR(name, field) \
+  static int glyphrun_##name (lua_State *L) { \
+    glyphrun_t* run = check_glyphrun(L, 1); \
+    lua_pushinteger(L, run->field[check_glyph_offset(L, run, 2)]); \
+    return 1; \
+  }
+
+GLYPHRUN_INTEGER_ACCESSOR(gid, gid)
+GLYPHRUN_INTEGER_ACCESSOR(index, cluster)
+GLYPHRUN_NUMBER_ACCESSOR(width, width)
+GLYPHRUN_NUMBER_ACCESSOR(glyphAdvance, glyph_advance)
+GLYPHRUN_NUMBER_ACCESSOR(height, height)
+GLYPHRUN_NUMBER_ACCESSOR(depth, depth)
+GLYPHRUN_NUMBER_ACCESSOR(x_offset, x_offset)
+GLYPHRUN_NUMBER_ACCESSOR(y_offset, y_offset)
+GLYPHRUN_NUMBER_ACCESSOR(x_bearing, x_bearing)
+GLYPHRUN_NUMBER_ACCESSOR(glyphWidth, glyph_width)
+
+static int glyphrun_name (lua_State *L) {
+  glyphrun_t* run = check_glyphrun(L, 1);
+  unsigned int j = check_glyph_offset(L, run, 2);
+  char namebuf[255];
+  namebuf[0] = '\0';
+  hb_font_get_glyph_name(run->font, run->gid[j], namebuf, 255);
+  lua_pushstring(L, namebuf);
+  return 1;
+}
+
+/* Pushes a table for glyph j in the same shape as the items returned by
+_shape(), except that the glyph name is left out. */
+static void push_glyph_item(lua_State *L, glyphrun_t* run, unsigned int j) {
+  lua_createtable(L, 0, 10);
+  if (run->x_offset[j] != 0) {
+    lua_pushnumber(L, run->x_offset[j]);
+    lua_setfield(L, -2, "x_offset");
+  }
+  if (run->y_offset[j] != 0) {
+    lua_pushnumber(L, run->y_offset[j]);
+    lua_setfield(L, -2, "y_offset");
+  }
+  lua_pushinteger(L, run->gid[j]);
+  lua_setfield(L, -2, "gid");
+  lua_pushinteger(L, run->cluster[j]);
+  lua_setfield(L, -2, "index");
+  lua_pushnumber(L, run->glyph_advance[j]);
+  lua_setfield(L, -2, "glyphAdvance");
+  lua_pushnumber(L, run->width[j]);
+  lua_setfield(L, -2, "width");
+  lua_pushnumber(L, run->height[j]);
+  lua_setfield(L, -2, "height");
+  lua_pushnumber(L, run->depth[j]);
+  lua_setfield(L, -2, "depth");
+  lua_pushnumber(L, run->x_bearing[j]);
+  lua_setfield(L, -2, "x_bearing");
+  lua_pushnumber(L, run->glyph_width[j]);
+  lua_setfield(L, -2, "glyphWidth");
+}
+
+static int glyphrun_glyph (lua_State *L) {
+  glyphrun_t* run = check_glyphrun(L, 1);
+  push_glyph_item(L, run, check_glyph_offset(L, run, 2));
+  return 1;
+}
+
+static int glyphrun_items (lua_State *L) {
+  glyphrun_t* run = check_glyphrun(L, 1);
+  unsigned int j;
+  lua_createtable(L, run->count, 0);
+  for (j = 0; j < run->count; ++j) {
+    push_glyph_item(L, run, j);
+    lua_rawseti(L, -2, j + 1);
+  }
+  return 1;
+}
+
+static const struct luaL_Reg glyphrun_methods [] = {
+  {"gid", glyphrun_gid},
+  {"index", glyphrun_index},
+  {"width", glyphrun_width},
+  {"glyphAdvance", glyphrun_glyphAdvance},
+  {"height", glyphrun_height},
+  {"depth", glyphrun_depth},
+  {"x_offset", glyphrun_x_offset},
+  {"y_offset", glyphrun_y_offset},
+  {"x_bearing", glyphrun_x_bearing},
+  {"glyphWidth", glyphrun_glyphWidth},
+  {"name", glyphrun_name},
+  {"glyph", glyphrun_glyph},
+  {"items", glyphrun_items},
+  {NULL, NULL}
+};
+
+/* Paragraph shaping.
+
+_shape_paragraph() runs bidi resolution, word and line segmentation and
+shaping over a whole paragraph in one pass, converting it to UTF-16 once and
+sharing that buffer between ICU and HarfBuzz. The caller splits the text into
+runs of a single font and language; runs are further split wherever the bidi
+embedding level changes. It returns the shaped segments in logical order
+followed by the paragraph's breakpoints as two packed arrays, in the same
+form as icu.breakpoints_packed(). All offsets (including glyph clusters)
+are UTF-8 byte offsets into the paragraph. */
+
+typedef struct {
+  int32_t* u8_offsets;  /* UTF-8 offset of each UTF-16 index (length + 1 entries) */
+  int32_t* u16_offsets; /* UTF-16 index of each UTF-8 offset (input_l + 1 entries) */
+  UChar* text;          /* The paragraph in UTF-16 */
+  int32_t length;       /* ...and its length in code units */
+} paragraph_text_t;
+
+typedef struct {
+  hb_font_t* font;
+  double point_size;
+  const char* script;
+  const char* lang;
+  const char* features;
+  const char* shapers;
+  hb_direction_t direction;
+  int32_t start; /* Range of the run in UTF-16 code units */
+  int32_t end;
+} paragraph_run_t;
+
+/* Converts the paragraph to UTF-16, recording offsets in both directions as
+we go. Memory is owned by a userdata left on the stack, so nothing leaks if
+a later step raises an error. */
+static void paragraph_text_init(lua_State *L, paragraph_text_t* para, const char* input, int32_t input_l) {
+  /* UTF-16 never needs more code units than UTF-8 needs bytes */
+  size_t offsets_l = (size_t)(input_l + 1) * sizeof(int32_t);
+  char* block = lua_newuserdata(L, 2 * offsets_l + (size_t)(input_l + 1) * sizeof(UChar));
+  int32_t i = 0, j = 0;
+
+  para->u8_offsets = (int32_t*)block;
+  para->u16_offsets = (int32_t*)(block + offsets_l);
+  para->text = (UChar*)(block + 2 * offsets_l);
+
+  while (i < input_l) {
+    int32_t start = i, k;
+    UChar32 c;
+    U8_NEXT(input, i, input_l, c);
+    if (c < 0) c = 0xFFFD;
+    for (k = start; k < i; k++)
+      para->u16_offsets[k] = j;
+    para->u8_offsets[j] = start;
+    if (U16_LENGTH(c) == 2)
+      para->u8_offsets[j + 1] = start;
+    U16_APPEND_UNSAFE(para->text, j, c);
+  }
+  para->u8_offsets[j] = input_l;
+  para->u16_offsets[input_l] = j;
+  para->length = j;
+}
+
+static char paragraph_break_locale[ULOC_FULLNAME_CAPACITY];
+static UBreakIterator* paragraph_words = NULL;
+static UBreakIterator* paragraph_lines = NULL;
+
+/* Pushes the packed breakpoint arrays for the paragraph */
+static void paragraph_breakpoints(lua_State *L, paragraph_text_t* para, const char* locale) {
+  UErrorCode err = U_ZERO_ERROR;
+  int32_t word, line;
+  lua_Integer n = 0;
+  int lineType = 3;
+
+  if (!paragraph_words || strcmp(paragraph_break_locale, locale)) {
+    if (paragraph_words) ubrk_close(paragraph_words);
+    if (paragraph_lines) ubrk_close(paragraph_lines);
+    paragraph_lines = NULL;
+    paragraph_words = ubrk_open(UBRK_WORD, locale, NULL, 0, &err);
+    if (U_SUCCESS(err))
+      paragraph_lines = ubrk_open(UBRK_LINE, locale, NULL, 0, &err);
+    if (U_FAILURE(err)) {
+      if (paragraph_words) ubrk_close(paragraph_words);
+      paragraph_words = NULL;
+      luaL_error(L, "Break iterator failure: %s", u_errorName(err));
+    }
+    strncpy(paragraph_break_locale, locale, ULOC_FULLNAME_CAPACITY - 1);
+    paragraph_break_locale[ULOC_FULLNAME_CAPACITY - 1] = '\0';
+  }
+  ubrk_setText(paragraph_words, para->text, para->length, &err);
+  ubrk_setText(paragraph_lines, para->text, para->length, &err);
+  if (U_FAILURE(err))
+    luaL_error(L, "Break iterator failure: %s", u_errorName(err));
+
+  lua_newtable(L);
+  lua_newtable(L);
+  word = ubrk_first(paragraph_words);
+  line = ubrk_first(paragraph_lines);
+  while (word != UBRK_DONE || line != UBRK_DONE) {
+    int32_t index;
+    int type;
+    if (line != UBRK_DONE) {
+      int32_t status = ubrk_getRuleStatus(paragraph_lines);
+      lineType = (status >= UBRK_LINE_SOFT && status < UBRK_LINE_SOFT_LIMIT) ? 2 : 3;
+    }
+    if (line != UBRK_DONE && (word == UBRK_DONE || line <= word)) {
+      index = line;
+      type = lineType;
+    } else {
+      index = word;
+      type = 1;
+    }
+    n++;
+    lua_pushinteger(L, para->u8_offsets[index]);
+    lua_rawseti(L, -3, n);
+    lua_pushinteger(L, type);
+    lua_rawseti(L, -2, n);
+    if (word == index) word = ubrk_next(paragraph_words);
+    if (line == index) line = ubrk_next(paragraph_lines);
+  }
+}
+
+static int push_paragraph_segment(lua_State *L, paragraph_text_t* para, paragraph_run_t* prun,
+                                   int runIndex, int32_t start, int32_t end,
+                                   UBiDiLevel level, hb_direction_t direction) {
+  hb_buffer_t* buf = acquire_buffer();
+  glyphrun_t* run;
+
+  hb_buffer_add_utf16(buf, (const uint16_t*)para->text, para->length, start, end - start);
+  shape_buffer(prun->font, buf, prun->script, direction, prun->lang, prun->features, prun->shapers);
+
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, runIndex);
+  lua_setfield(L, -2, "run");
+  lua_pushinteger(L, para->u8_offsets[start]);
+  lua_setfield(L, -2, "start");
+  lua_pushinteger(L, para->u8_offsets[end] - para->u8_offsets[start]);
+  lua_setfield(L, -2, "length");
+  lua_pushinteger(L, level);
+  lua_setfield(L, -2, "level");
+  lua_pushstring(L, direction == HB_DIRECTION_RTL ? "RTL" : direction == HB_DIRECTION_TTB ? "TTB" : "LTR");
+  lua_setfield(L, -2, "direction");
+
+  run = (glyphrun_t*)lua_newuserdata(L, sizeof(glyphrun_t));
+  memset(run, 0, sizeof(glyphrun_t));
+  luaL_setmetatable(L, GLYPHRUN_MT);
+  if (!fill_glyphrun(run, prun->font, buf, direction, prun->point_size, para->u8_offsets)) {
+    release_buffer(buf);
+    return 0;
+  }
+  release_buffer(buf);
+  lua_setfield(L, -2, "glyphs");
+  return 1;
+}
+
+int je_hb_shape_paragraph (lua_State *L) {
+  size_t input_l;
+  const char* input = luaL_checklstring(L, 1, &input_l);
+  lua_Integer nRuns, i;
+  paragraph_text_t para;
+  paragraph_run_t* pruns;
+  const char* paraDirection = "LTR";
+  const char* breakLocale = NULL;
+  int doBidi = 1;
+  UBiDi* bidi = NULL;
+  const UBiDiLevel* levels = NULL;
+  UBiDiLevel paraLevel;
+  int segments;
+  lua_Integer nSegments = 0;
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (lua_istable(L, 3)) {
+    paraDirection = run_string_field(L, 3, "direction", paraDirection);
+    breakLocale = run_string_field(L, 3, "breaks", NULL);
+    lua_getfield(L, 3, "bidi");
+    if (lua_isboolean(L, -1)) doBidi = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  lua_settop(L, 3);
+  luaL_argcheck(L, input_l < 0x7fffffff, 1, "paragraph too long");
+  paraLevel = !strcasecmp(paraDirection, "RTL") ? 1 : 0;
+
+  paragraph_text_init(L, &para, input, (int32_t)input_l); /* index 4 */
+
+  /* Resolve everything that can raise an error before ICU allocates */
+  nRuns = luaL_len(L, 2);
+  pruns = (paragraph_run_t*)lua_newuserdata(L, (size_t)(nRuns + 1) * sizeof(paragraph_run_t)); /* index 5 */
+  for (i = 1; i <= nRuns; i++) {
+    paragraph_run_t* prun = &pruns[i - 1];
+    lua_Integer start, length;
+    lua_rawgeti(L, 2, i);
+    int runIndex = lua_gettop(L);
+    luaL_argcheck(L, lua_istable(L, runIndex), 2, "each run must be a table");
+
+    lua_getfield(L, runIndex, "start");
+    start = luaL_checkinteger(L, -1);
+    lua_getfield(L, runIndex, "length");
+    length = luaL_checkinteger(L, -1);
+    luaL_argcheck(L, start >= 0 && length >= 0 && start + length <= (lua_Integer)input_l, 2, "run out of range");
+    prun->start = para.u16_offsets[start];
+    prun->end = para.u16_offsets[start + length];
+
+    lua_getfield(L, runIndex, "face");
+    prun->font = get_hb_font(L, lua_gettop(L));
+    lua_getfield(L, runIndex, "pointsize");
+    prun->point_size = luaL_checknumber(L, -1);
+    prun->script = run_string_field(L, runIndex, "script", "");
+    prun->lang = run_string_field(L, runIndex, "language", "");
+    prun->features = run_string_field(L, runIndex, "features", "");
+    prun->shapers = run_string_field(L, runIndex, "shapers", "");
+    prun->direction = parse_direction(run_string_field(L, runIndex, "direction", paraDirection));
+    if (!breakLocale && i == 1)
+      breakLocale = prun->lang;
+    lua_settop(L, 5);
+  }
+
+  /* Segmentation */
+  lua_newtable(L); /* index 6: segments */
+  segments = lua_gettop(L);
+  paragraph_breakpoints(L, &para, breakLocale ? breakLocale : ""); /* indices 7 and 8 */
+
+  /* Bidi */
+  if (doBidi && para.length > 0) {
+    UErrorCode err = U_ZERO_ERROR;
+    bidi = ubidi_open();
+    ubidi_setPara(bidi, para.text, para.length, paraLevel, NULL, &err);
+    if (U_SUCCESS(err))
+      levels = ubidi_getLevels(bidi, &err);
+    if (U_FAILURE(err)) {
+      ubidi_close(bidi);
+      return luaL_error(L, "Error in bidi %s", u_errorName(err));
+    }
+  }
+
+  /* Shaping, one segment per run and embedding level */
+  for (i = 0; i < nRuns; i++) {
+    paragraph_run_t* prun = &pruns[i];
+    int32_t start = prun->start;
+    if (!levels || prun->direction == HB_DIRECTION_TTB) {
+      if (prun->end > start) {
+        if (!push_paragraph_segment(L, &para, prun, (int)i + 1, start, prun->end, paraLevel, prun->direction))
+          goto oom;
+        lua_rawseti(L, segments, ++nSegments);
+      }
+      continue;
+    }
+    while (start < prun->end) {
+      UBiDiLevel level = levels[start];
+      int32_t end = start + 1;
+      while (end < prun->end && levels[end] == level)
+        end++;
+      if (!push_paragraph_segment(L, &para, prun, (int)i + 1, start, end, level,
+                                  (level & 1) ? HB_DIRECTION_RTL : HB_DIRECTION_LTR))
+        goto oom;
+      lua_rawseti(L, segments, ++nSegments);
+      start = end;
+    }
+  }
+
+  if (bidi) ubidi_close(bidi);
+  return 3;
+
+oom:
+  if (bidi) ubidi_close(bidi);
+  return luaL_error(L, "Out of memory in shaper");
+}
+
+int je_hb_get_glyph_name (lua_State *L) {
+  hb_font_t* hbFont = get_hb_font(L, 1);
+  hb_codepoint_t glyphId = (hb_codepoint_t)luaL_checkinteger(L, 2);
+  char namebuf[255];
+  namebuf[0] = '\0';
+  hb_font_get_glyph_name(hbFont, glyphId, namebuf, 255);
+  lua_pushstring(L, namebuf);
+  return 1;
+}
+
 static int has_table(hb_face_t* face, hb_tag_t tag) {
   hb_blob_t *blob = hb_face_reference_table(face, tag);
   int ret = hb_blob_get_length(blob) != 0;
@@ -377,6 +1067,28 @@ int je_hb_instantiate(lua_State *L) {
   return 1;
 }
 
+/* Returns the design coordinates the font's variation axes are set to, which
+is what instantiate() pins them at. Nothing is returned for fonts without
+variations, or when hb-subset support is not available. */
+int je_hb_get_var_coords(lua_State *L) {
+  int n = 0;
+#ifdef HAVE_HARFBUZZ_SUBSET
+  hb_font_t* font = get_hb_font(L, 1);
+  unsigned int nCoords = 0;
+  const float* coords;
+
+  if (hb_ot_var_has_data(hb_font_get_face(font))) {
+    coords = hb_font_get_var_coords_design(font, &nCoords);
+    lua_checkstack(L, nCoords);
+    for (n = 0; n < (int)nCoords; n++)
+      lua_pushnumber(L, coords[n]);
+  }
+#else
+  (void)L;
+#endif
+  return n;
+}
+
 int je_hb_get_glyph_dimensions(lua_State *L) {
   hb_font_t* hbFont = get_hb_font(L, 1);
   double point_size = (unsigned int)luaL_checknumber(L, 2);
@@ -460,16 +1172,31 @@ int je_hb_get_table (lua_State *L) {
 
 static const struct luaL_Reg lib_table [] = {
   {"_shape", je_hb_shape},
+  {"_shape_batch", je_hb_shape_batch},
+  {"_shape_paragraph", je_hb_shape_paragraph},
+  {"get_glyph_name", je_hb_get_glyph_name},
   {"get_glyph_dimensions", je_hb_get_glyph_dimensions},
   {"version", je_hb_get_harfbuzz_version},
   {"shapers", je_hb_list_shapers},
   {"get_table", je_hb_get_table},
   {"instantiate", je_hb_instantiate},
+  {"get_var_coords", je_hb_get_var_coords},
   {"version_lessthan", je_hb_version_lessthan},
   {NULL, NULL}
 };
 
 int luaopen_justenoughharfbuzz (lua_State *L) {
+  if (luaL_newmetatable(L, GLYPHRUN_MT)) {
+    lua_newtable(L);
+    luaL_setfuncs(L, glyphrun_methods, 0);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, glyphrun_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, glyphrun_len);
+    lua_setfield(L, -2, "__len");
+  }
+  lua_pop(L, 1);
+
   lua_newtable(L);
   luaL_setfuncs(L, lib_table, 0);
   return 1;
@@ -0,0 +1,634 @@
+/* Compiled hyphenation patterns for core/hyphenator-liang.lua.
+ *
+ * Liang's patterns are compiled into a double-array trie over a dense
+ * alphabet of the codepoints they use. The compiled form is one
+ * position-independent buffer, so it is written to a cache file as is and
+ * mapped back in by later runs instead of being rebuilt from the pattern
+ * list. Words are then hyphenated without creating any Lua tables. */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+/* #define COMPAT53_PREFIX compat53 */
+#include "compat-5.3.h"
+
+#define PATTERNS_MT "justenoughhyphen.patterns"
+#define PATTERNS_MAGIC "SILEHYF1"
+#define BYTE_ORDER_MARK 0x01020304u
+#define FREE_SLOT (-1)
+#define ROOT 0
+#define SHORT_WORD 64
+
+/* Layout of the compiled buffer: the header is followed by the sorted
+ * alphabet, the base, check and output arrays of the double array, and the
+ * pattern values. Each output is 0 or one more than the offset of a length
+ * byte followed by that many values, as in the digit lists of the Lua trie. */
+typedef struct {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t alphabet;
+  uint32_t size;
+  uint32_t nvalues;
+} hyph_header;
+
+typedef struct {
+  unsigned char* data;
+  size_t length;
+  int mapped;
+  const uint32_t* alphabet;
+  const int32_t* base;
+  const int32_t* check;
+  const uint32_t* output;
+  const unsigned char* values;
+  uint32_t nalphabet, size, nvalues;
+} hyph_patterns;
+
+/* Decodes one codepoint, taking stray bytes as they are */
+static uint32_t next_codepoint(const unsigned char* s, size_t len, size_t* i) {
+  uint32_t c = s[(*i)++];
+  int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+  uint32_t cp = extra == 3 ? c & 0x07 : extra == 2 ? c & 0x0F : extra == 1 ? c & 0x1F : c;
+  for (; extra > 0 && *i < len && (s[*i] & 0xC0) == 0x80; extra--)
+    cp = (cp << 6) | (s[(*i)++] & 0x3F);
+  return extra ? c : cp;
+}
+
+static int compare_codepoints(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Symbol of a codepoint in the alphabet, 0 if it is not in it */
+static int32_t symbol(const uint32_t* alphabet, uint32_t count, uint32_t cp) {
+  uint32_t lo = 0, hi = count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (alphabet[mid] < cp)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < count && alphabet[lo] == cp ? (int32_t)lo + 1 : 0;
+}
+
+/* Points the arrays of a compiled buffer, returning 0 if it is not valid */
+static int view_patterns(hyph_patterns* p) {
+  hyph_header header;
+  size_t slots;
+  if (p->length < sizeof(hyph_header))
+    return 0;
+  memcpy(&header, p->data, sizeof(hyph_header));
+  if (memcmp(header.magic, PATTERNS_MAGIC, 8) || header.byte_order != BYTE_ORDER_MARK)
+    return 0;
+  if (header.alphabet > 0x110000u || header.size == 0 || header.size > 0x10000000u)
+    return 0;
+  slots = (size_t)header.alphabet + 3 * (size_t)header.size;
+  if (p->length != sizeof(hyph_header) + 4 * slots + header.nvalues)
+    return 0;
+  p->nalphabet = header.alphabet;
+  p->size = header.size;
+  p->nvalues = header.nvalues;
+  p->alphabet = (const uint32_t*)(p->data + sizeof(hyph_header));
+  p->base = (const int32_t*)(p->alphabet + header.alphabet);
+  p->check = p->base + header.size;
+  p->output = (const uint32_t*)(p->check + header.size);
+  p->values = (const unsigned char*)(p->output + header.size);
+  return 1;
+}
+
+/* Node of the pointer-based trie the double array is built from */
+typedef struct {
+  int32_t symbol, child, sibling, slot;
+  uint32_t output;
+} build_node;
+
+typedef struct {
+  uint32_t* codepoints;
+  build_node* nodes;
+  unsigned char* values;
+  int32_t* base;
+  int32_t* check;
+  uint32_t* output;
+  int32_t *next_free, *prev_free; /* Doubly linked list of the free slots */
+  int32_t free_head, free_tail;
+  int32_t* queue;
+  size_t ncodepoints, nnodes, nvalues, size, slots;
+  size_t codepoints_cap, nodes_cap, values_cap;
+} build_state;
+
+static int reserve(void** buffer, size_t* cap, size_t need, size_t elem) {
+  size_t n = *cap ? *cap : 256;
+  void* grown;
+  if (need <= *cap)
+    return 1;
+  while (n < need)
+    n *= 2;
+  grown = realloc(*buffer, n * elem);
+  if (!grown)
+    return 0;
+  *buffer = grown;
+  *cap = n;
+  return 1;
+}
+
+static void free_build(build_state* b) {
+  free(b->codepoints);
+  free(b->nodes);
+  free(b->values);
+  free(b->base);
+  free(b->check);
+  free(b->output);
+  free(b->next_free);
+  free(b->prev_free);
+  free(b->queue);
+}
+
+static int grow_array(void** array, size_t n) {
+  void* grown = realloc(*array, n * 4);
+  if (!grown)
+    return 0;
+  *array = grown;
+  return 1;
+}
+
+/* Grows the double array to at least need slots, adding the new ones to the
+ * end of the free list */
+static int reserve_slots(build_state* b, size_t need) {
+  size_t n = b->slots ? b->slots : 1024, i;
+  if (need <= b->slots)
+    return 1;
+  while (n < need)
+    n *= 2;
+  if (n > 0x10000000u)
+    return 0;
+  if (!grow_array((void**)&b->base, n) || !grow_array((void**)&b->check, n) || !grow_array((void**)&b->output, n) ||
+      !grow_array((void**)&b->next_free, n) || !grow_array((void**)&b->prev_free, n))
+    return 0;
+  for (i = b->slots; i < n; i++) {
+    b->base[i] = 0;
+    b->check[i] = FREE_SLOT;
+    b->output[i] = 0;
+    b->prev_free[i] = i == b->slots ? b->free_tail : (int32_t)i - 1;
+    b->next_free[i] = i + 1 < n ? (int32_t)i + 1 : -1;
+  }
+  if (b->free_tail >= 0)
+    b->next_free[b->free_tail] = (int32_t)b->slots;
+  else
+    b->free_head = (int32_t)b->slots;
+  b->free_tail = (int32_t)n - 1;
+  b->slots = n;
+  return 1;
+}
+
+static void take_slot(build_state* b, int32_t slot, int32_t parent) {
+  int32_t prev = b->prev_free[slot], next = b->next_free[slot];
+  if (prev >= 0)
+    b->next_free[prev] = next;
+  else
+    b->free_head = next;
+  if (next >= 0)
+    b->prev_free[next] = prev;
+  else
+    b->free_tail = prev;
+  b->check[slot] = parent;
+  if ((size_t)slot >= b->size)
+    b->size = (size_t)slot + 1;
+}
+
+static int32_t child_node(build_state* b, int32_t parent, int32_t sym) {
+  int32_t prev = -1, node = b->nodes[parent].child;
+  while (node >= 0 && b->nodes[node].symbol < sym) {
+    prev = node;
+    node = b->nodes[node].sibling;
+  }
+  if (node >= 0 && b->nodes[node].symbol == sym)
+    return node;
+  if (!reserve((void**)&b->nodes, &b->nodes_cap, b->nnodes + 1, sizeof(build_node)))
+    return -1;
+  b->nodes[b->nnodes].symbol = sym;
+  b->nodes[b->nnodes].child = -1;
+  b->nodes[b->nnodes].sibling = node;
+  b->nodes[b->nnodes].output = 0;
+  if (prev >= 0)
+    b->nodes[prev].sibling = (int32_t)b->nnodes;
+  else
+    b->nodes[parent].child = (int32_t)b->nnodes;
+  return (int32_t)b->nnodes++;
+}
+
+/* Adds a pattern to the trie, its digits making up the values as in
+ * addPattern() in core/hyphenator-liang.lua */
+static int add_pattern(build_state* b, const unsigned char* s, size_t len) {
+  size_t i = 0, start;
+  int32_t node = ROOT;
+  int last_was_digit = 0;
+  unsigned char count = 0;
+  while (i < len) {
+    uint32_t cp = next_codepoint(s, len, &i);
+    if (cp >= '0' && cp <= '9')
+      continue;
+    node = child_node(b, node, symbol(b->codepoints, (uint32_t)b->ncodepoints, cp));
+    if (node < 0)
+      return 0;
+  }
+  if (!reserve((void**)&b->values, &b->values_cap, b->nvalues + len + 2, 1))
+    return 0;
+  start = b->nvalues++;
+  for (i = 0; i < len;) {
+    uint32_t cp = next_codepoint(s, len, &i);
+    if (cp >= '0' && cp <= '9') {
+      last_was_digit = 1;
+      b->values[b->nvalues++] = (unsigned char)(cp - '0');
+      count++;
+    } else if (last_was_digit) {
+      last_was_digit = 0;
+    } else {
+      b->values[b->nvalues++] = 0;
+      count++;
+    }
+  }
+  b->values[start] = count;
+  b->nodes[node].output = (uint32_t)start + 1;
+  return 1;
+}
+
+/* Places the children of every node in the double array, breadth first,
+ * each family at the first base where all of its slots are free. Only free
+ * slots are tried for the first child, so the search skips the densely
+ * packed front of the array. */
+static int place_nodes(build_state* b) {
+  size_t head = 0, tail = 0;
+  b->free_head = b->free_tail = -1;
+  b->queue = (int32_t*)malloc(b->nnodes * sizeof(int32_t));
+  if (!b->queue || !reserve_slots(b, b->ncodepoints + 2))
+    return 0;
+  b->nodes[ROOT].slot = ROOT;
+  take_slot(b, ROOT, ROOT);
+  b->queue[tail++] = ROOT;
+  while (head < tail) {
+    int32_t node = b->queue[head++], child, free_slot;
+    int32_t first = b->nodes[node].child;
+    size_t base = 0;
+    if (first < 0)
+      continue;
+    for (free_slot = b->free_head; free_slot >= 0; free_slot = b->next_free[free_slot]) {
+      if (free_slot < b->nodes[first].symbol)
+        continue;
+      base = (size_t)(free_slot - b->nodes[first].symbol);
+      for (child = b->nodes[first].sibling; child >= 0; child = b->nodes[child].sibling) {
+        size_t slot = base + (size_t)b->nodes[child].symbol;
+        if (!reserve_slots(b, slot + 1))
+          return 0;
+        if (b->check[slot] != FREE_SLOT)
+          break;
+      }
+      if (child < 0)
+        break;
+    }
+    b->base[b->nodes[node].slot] = (int32_t)base;
+    for (child = first; child >= 0; child = b->nodes[child].sibling) {
+      int32_t slot = (int32_t)(base + (size_t)b->nodes[child].symbol);
+      b->nodes[child].slot = slot;
+      take_slot(b, slot, b->nodes[node].slot);
+      b->output[slot] = b->nodes[child].output;
+      b->queue[tail++] = child;
+    }
+    /* Keep free slots past the last used one for the next family */
+    if (!reserve_slots(b, b->size + b->ncodepoints + 1))
+      return 0;
+  }
+  return 1;
+}
+
+static unsigned char* serialize(build_state* b, size_t* length) {
+  hyph_header header;
+  unsigned char *data, *at;
+  memcpy(header.magic, PATTERNS_MAGIC, 8);
+  header.byte_order = BYTE_ORDER_MARK;
+  header.alphabet = (uint32_t)b->ncodepoints;
+  header.size = (uint32_t)b->size;
+  header.nvalues = (uint32_t)b->nvalues;
+  *length = sizeof(hyph_header) + 4 * (b->ncodepoints + 3 * b->size) + b->nvalues;
+  data = at = (unsigned char*)malloc(*length);
+  if (!data)
+    return NULL;
+  memcpy(at, &header, sizeof(hyph_header));
+  at += sizeof(hyph_header);
+  memcpy(at, b->codepoints, 4 * b->ncodepoints);
+  at += 4 * b->ncodepoints;
+  memcpy(at, b->base, 4 * b->size);
+  at += 4 * b->size;
+  memcpy(at, b->check, 4 * b->size);
+  at += 4 * b->size;
+  memcpy(at, b->output, 4 * b->size);
+  at += 4 * b->size;
+  memcpy(at, b->values, b->nvalues);
+  return data;
+}
+
+static hyph_patterns* new_patterns(lua_State* L) {
+  hyph_patterns* p = (hyph_patterns*)lua_newuserdata(L, sizeof(hyph_patterns));
+  memset(p, 0, sizeof(hyph_patterns));
+  luaL_setmetatable(L, PATTERNS_MT);
+  return p;
+}
+
+static hyph_patterns* check_patterns(lua_State* L, int index) {
+  return (hyph_patterns*)luaL_checkudata(L, index, PATTERNS_MT);
+}
+
+/* compile(patterns)
+ *
+ * Compiles a list of Liang patterns, such as the patterns field of a
+ * languages/xx/hyphens.lua file. Later duplicates of a pattern win, as in the
+ * Lua trie. */
+int je_hyphen_compile(lua_State* L) {
+  build_state b;
+  hyph_patterns* p;
+  lua_Integer i, n;
+  size_t j, k, length;
+  unsigned char* data;
+  int ok = 1;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  n = luaL_len(L, 1);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 1, i);
+    if (lua_type(L, -1) != LUA_TSTRING)
+      return luaL_error(L, "pattern %d is not a string", (int)i);
+    lua_pop(L, 1);
+  }
+  p = new_patterns(L);
+  memset(&b, 0, sizeof(build_state));
+
+  /* The alphabet, with the digits left out */
+  for (i = 1; ok && i <= n; i++) {
+    const unsigned char* s;
+    size_t len;
+    lua_rawgeti(L, 1, i);
+    s = (const unsigned char*)lua_tolstring(L, -1, &len);
+    for (j = 0; ok && j < len;) {
+      uint32_t cp = next_codepoint(s, len, &j);
+      if (cp >= '0' && cp <= '9')
+        continue;
+      ok = reserve((void**)&b.codepoints, &b.codepoints_cap, b.ncodepoints + 1, sizeof(uint32_t));
+      if (ok)
+        b.codepoints[b.ncodepoints++] = cp;
+    }
+    lua_pop(L, 1);
+  }
+  if (ok && b.ncodepoints > 0) {
+    qsort(b.codepoints, b.ncodepoints, sizeof(uint32_t), compare_codepoints);
+    for (j = 1, k = 1; j < b.ncodepoints; j++)
+      if (b.codepoints[j] != b.codepoints[k - 1])
+        b.codepoints[k++] = b.codepoints[j];
+    b.ncodepoints = k;
+  }
+
+  ok = ok && reserve((void**)&b.nodes, &b.nodes_cap, 1, sizeof(build_node));
+  if (ok) {
+    b.nodes[ROOT].symbol = 0;
+    b.nodes[ROOT].child = b.nodes[ROOT].sibling = -1;
+    b.nodes[ROOT].output = 0;
+    b.nnodes = 1;
+  }
+  for (i = 1; ok && i <= n; i++) {
+    const unsigned char* s;
+    size_t len;
+    lua_rawgeti(L, 1, i);
+    s = (const unsigned char*)lua_tolstring(L, -1, &len);
+    ok = len < 255 ? add_pattern(&b, s, len) : 1;
+    lua_pop(L, 1);
+  }
+  ok = ok && place_nodes(&b);
+  data = ok ? serialize(&b, &length) : NULL;
+  free_build(&b);
+  if (!data)
+    return luaL_error(L, "Out of memory compiling hyphenation patterns");
+  p->data = data;
+  p->length = length;
+  view_patterns(p);
+  return 1;
+}
+
+/* open(path)
+ *
+ * Maps a file written by patterns:save(). Returns nil and a message if it
+ * cannot be read or was not written by this version. */
+int je_hyphen_open(lua_State* L) {
+  const char* path = luaL_checkstring(L, 1);
+  hyph_patterns* p = new_patterns(L);
+#ifndef _WIN32
+  struct stat st;
+  void* data;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    close(fd);
+    lua_pushnil(L);
+    lua_pushstring(L, "empty compiled patterns file");
+    return 2;
+  }
+  data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  p->data = (unsigned char*)data;
+  p->length = (size_t)st.st_size;
+  p->mapped = 1;
+#else
+  long size;
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0 &&
+      (p->data = (unsigned char*)malloc((size_t)size)) != NULL) {
+    p->length = fread(p->data, 1, (size_t)size, file);
+  }
+  fclose(file);
+#endif
+  if (!p->data || !view_patterns(p)) {
+    lua_pushnil(L);
+    lua_pushstring(L, "not a compiled patterns file");
+    return 2;
+  }
+  return 1;
+}
+
+/* patterns:save(path)
+ *
+ * Writes the compiled patterns to a file. Returns true, or nil and a
+ * message. */
+static int patterns_save(lua_State* L) {
+  hyph_patterns* p = check_patterns(L, 1);
+  const char* path = luaL_checkstring(L, 2);
+  FILE* file = fopen(path, "wb");
+  int ok;
+  if (!file) {
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  ok = fwrite(p->data, 1, p->length, file) == p->length;
+  ok = fclose(file) == 0 && ok;
+  if (!ok) {
+    lua_pushnil(L);
+    lua_pushstring(L, "could not write compiled patterns");
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* patterns:hyphenate(text, lowertext, leftmin, rightmin)
+ *
+ * Runs the patterns over the lowercased word and returns the byte offsets
+ * in text after which it may be broken, leftmin and rightmin characters from
+ * its ends. The two strings must have the same number of codepoints. */
+static int patterns_hyphenate(lua_State* L) {
+  hyph_patterns* p = check_patterns(L, 1);
+  size_t tlen, llen, i, j, n = 0;
+  const unsigned char* text = (const unsigned char*)luaL_checklstring(L, 2, &tlen);
+  const unsigned char* lower = (const unsigned char*)luaL_optlstring(L, 3, (const char*)text, &llen);
+  lua_Integer leftmin = luaL_optinteger(L, 4, 2);
+  lua_Integer rightmin = luaL_optinteger(L, 5, 2);
+  int32_t short_work[SHORT_WORD + 2], *work = short_work;
+  unsigned char short_points[SHORT_WORD + 1], *points = short_points;
+  int32_t dot = symbol(p->alphabet, p->nalphabet, '.');
+  int results = 0;
+
+  for (i = 0; i < llen; n++)
+    next_codepoint(lower, llen, &i);
+  if (n > SHORT_WORD) {
+    work = (int32_t*)lua_newuserdata(L, (n + 2) * sizeof(int32_t));
+    points = (unsigned char*)lua_newuserdata(L, n + 1);
+  }
+  work[0] = work[n + 1] = dot;
+  for (i = 0, j = 1; i < llen; j++)
+    work[j] = symbol(p->alphabet, p->nalphabet, next_codepoint(lower, llen, &i));
+  memset(points, 0, n + 1);
+
+  /* points[k] is the value between the k-th and the (k+1)-th character */
+  for (i = 0; i < n + 2; i++) {
+    int32_t s = ROOT;
+    for (j = i; j < n + 2 && work[j]; j++) {
+      int64_t t = (int64_t)p->base[s] + work[j];
+      uint32_t out;
+      if (t < 0 || t >= p->size || p->check[t] != s)
+        break;
+      s = (int32_t)t;
+      out = p->output[s];
+      if (out && out <= p->nvalues) {
+        size_t k, count = p->values[out - 1];
+        for (k = 0; k < count && out + k < p->nvalues; k++) {
+          size_t at = i + k;
+          unsigned char v = p->values[out + k];
+          if (at >= 1 && at <= n + 1 && points[at - 1] < v)
+            points[at - 1] = v;
+        }
+      }
+    }
+  }
+
+  for (i = 0, j = 1; i < tlen && j <= n; j++) {
+    next_codepoint(text, tlen, &i);
+    if ((lua_Integer)j >= leftmin && (lua_Integer)j <= (lua_Integer)n - rightmin && (points[j] & 1)) {
+      luaL_checkstack(L, 1, "too many hyphenation points");
+      lua_pushinteger(L, (lua_Integer)i);
+      results++;
+    }
+  }
+  return results;
+}
+
+static int patterns_gc(lua_State* L) {
+  hyph_patterns* p = check_patterns(L, 1);
+#ifndef _WIN32
+  if (p->mapped) {
+    munmap(p->data, p->length);
+    p->data = NULL;
+  }
+#endif
+  free(p->data);
+  p->data = NULL;
+  return 0;
+}
+
+/* digest(patterns)
+ *
+ * Returns the 64-bit FNV-1a hash of a pattern list as 16 hex digits, naming
+ * the cache file of its compiled form. */
+int je_hyphen_digest(lua_State* L) {
+  uint64_t hash = UINT64_C(14695981039346656037);
+  lua_Integer i, n;
+  size_t len, j;
+  char hex[17];
+  luaL_checktype(L, 1, LUA_TTABLE);
+  n = luaL_len(L, 1);
+  for (i = 1; i <= n; i++) {
+    const unsigned char* s;
+    lua_rawgeti(L, 1, i);
+    s = (const unsigned char*)lua_tolstring(L, -1, &len);
+    for (j = 0; s && j <= len; j++) {
+      hash ^= j < len ? s[j] : '\n';
+      hash *= UINT64_C(1099511628211);
+    }
+    lua_pop(L, 1);
+  }
+  snprintf(hex, sizeof(hex), "%016" PRIx64, hash);
+  lua_pushlstring(L, hex, 16);
+  return 1;
+}
+
+static const struct luaL_Reg patterns_methods [] = {
+  {"hyphenate", patterns_hyphenate},
+  {"save", patterns_save},
+  {NULL, NULL}
+};
+
+static const struct luaL_Reg lib_table [] = {
+  {"compile", je_hyphen_compile},
+  {"open", je_hyphen_open},
+  {"digest", je_hyphen_digest},
+  {NULL, NULL}
+};
+
+int luaopen_justenoughhyphen (lua_State *L) {
+  if (luaL_newmetatable(L, PATTERNS_MT)) {
+    lua_newtable(L);
+    luaL_setfuncs(L, patterns_methods, 0);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, patterns_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L, 1);
+
+  lua_newtable(L);
+  luaL_setfuncs(L, lib_table, 0);
+  return 1;
+}
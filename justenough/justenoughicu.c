@@ -7,6 +7,8 @@
 #include <unicode/ustdio.h>
 #include <unicode/unum.h>
 #include <unicode/ubrk.h>
+#include <unicode/utext.h>
+#include <unicode/uloc.h>
 #include <unicode/ubidi.h>
 #include <unicode/ucol.h>
 #include <unicode/utf16.h>
@@ -101,78 +103,161 @@ int je_icu_case(lua_State *L) {
     return luaL_error(L, "Error in UTF8 conversion %s", u_errorName(err));
 }
 
-int je_icu_breakpoints(lua_State *L) {
-  const char* input = luaL_checkstring(L, 1);
-  int input_l = strlen(input);
-  const char* locale = luaL_checkstring(L, 2);
-  UChar *buffer;
-  int32_t l, breakcount = 0;
+/* Break iterators are expensive to open, so we keep a pair (word and line)
+around for each of the most recently used locales and point them at new
+text as needed. */
+
+#define BREAK_ITERATOR_CACHE_SIZE 8
+
+typedef struct {
+  char locale[ULOC_FULLNAME_CAPACITY];
+  UBreakIterator* words;
+  UBreakIterator* lines;
+  unsigned long lastUsed;
+} break_iterators_t;
+
+static break_iterators_t break_iterator_cache[BREAK_ITERATOR_CACHE_SIZE];
+static unsigned long break_iterator_clock = 0;
+
+static break_iterators_t* get_break_iterators(lua_State *L, const char* locale) {
+  break_iterators_t* slot = &break_iterator_cache[0];
   UErrorCode err = U_ZERO_ERROR;
-  u_strFromUTF8(NULL, 0, &l, input, input_l, &err);
-  /* Above call returns an error every time. */
-  err = U_ZERO_ERROR;
-  buffer = malloc(l * sizeof(UChar));
-  u_strFromUTF8(buffer, l, &l, input, input_l, &err);
-
-  UBreakIterator* wordbreaks, *linebreaks;
-  int32_t i, previous;
-  wordbreaks = ubrk_open(UBRK_WORD, locale, buffer, l, &err);
-  if(U_FAILURE(err)) {
-    luaL_error(L, "Word break parser failure: %s", u_errorName(err));
+  int i;
+
+  for (i = 0; i < BREAK_ITERATOR_CACHE_SIZE; i++) {
+    break_iterators_t* entry = &break_iterator_cache[i];
+    if (entry->words && !strcmp(entry->locale, locale)) {
+      entry->lastUsed = ++break_iterator_clock;
+      return entry;
+    }
+    if (entry->lastUsed < slot->lastUsed)
+      slot = entry;
   }
 
-  linebreaks = ubrk_open(UBRK_LINE, locale, buffer, l, &err);
-  if(U_FAILURE(err)) {
+  /* Reuse the least recently used slot */
+  if (slot->words) ubrk_close(slot->words);
+  if (slot->lines) ubrk_close(slot->lines);
+  slot->words = slot->lines = NULL;
+
+  slot->words = ubrk_open(UBRK_WORD, locale, NULL, 0, &err);
+  if (U_FAILURE(err)) {
+    slot->words = NULL;
+    luaL_error(L, "Word break parser failure: %s", u_errorName(err));
+  }
+  slot->lines = ubrk_open(UBRK_LINE, locale, NULL, 0, &err);
+  if (U_FAILURE(err)) {
+    ubrk_close(slot->words);
+    slot->words = slot->lines = NULL;
     luaL_error(L, "Line break parser failure: %s", u_errorName(err));
   }
+  strncpy(slot->locale, locale, ULOC_FULLNAME_CAPACITY - 1);
+  slot->locale[ULOC_FULLNAME_CAPACITY - 1] = '\0';
+  slot->lastUsed = ++break_iterator_clock;
+  return slot;
+}
 
-  previous = 0;
-  i = 0;
-  while (i <= l) {
-    int32_t type;
-    if (!ubrk_isBoundary(linebreaks, i) && !ubrk_isBoundary(wordbreaks,i)) {
-      i++; continue;
-    }
-    lua_checkstack(L, 3);
-    /* At some kind of boundary */
-    lua_newtable(L);
-    lua_pushstring(L, "type");
-    lua_pushstring(L, ubrk_isBoundary(linebreaks,i) ? "line" : "word");
-    lua_settable(L, -3);
+#define BREAK_WORD 1
+#define BREAK_LINE_SOFT 2
+#define BREAK_LINE_HARD 3
 
-    int32_t utf8_index = 0;
-    err = U_ZERO_ERROR;
-    u_strToUTF8(NULL, 0, &utf8_index, buffer, i, &err);
-    assert(U_SUCCESS(err) || err == U_BUFFER_OVERFLOW_ERROR);
+typedef void (*break_callback_t)(lua_State *L, int32_t index, int type, int32_t previous, void* data);
 
-    lua_pushstring(L, "index");
-    lua_pushinteger(L, utf8_index);
-    lua_settable(L, -3);
+/* Walks the word and line boundaries of a UTF-8 string in order, calling back
+once for each position that is a boundary of either kind. The iterators work
+on the UTF-8 directly, so positions are already byte offsets. */
+static int32_t each_breakpoint(lua_State *L, const char* input, size_t input_l,
+                               const char* locale, break_callback_t callback, void* data) {
+  break_iterators_t* iterators = get_break_iterators(L, locale);
+  UText text = UTEXT_INITIALIZER;
+  UErrorCode err = U_ZERO_ERROR;
+  int32_t word, line, previous = 0, breakcount = 0;
+  int lineType = BREAK_LINE_HARD;
+
+  utext_openUTF8(&text, input, input_l, &err);
+  ubrk_setUText(iterators->words, &text, &err);
+  ubrk_setUText(iterators->lines, &text, &err);
+  if (U_FAILURE(err)) {
+    utext_close(&text);
+    return luaL_error(L, "Break iterator failure: %s", u_errorName(err));
+  }
 
-    if (ubrk_isBoundary(linebreaks, i)) {
-      lua_pushstring(L, "subtype");
-      type = ubrk_getRuleStatus(linebreaks);
-      if (type >= UBRK_LINE_SOFT && type < UBRK_LINE_SOFT_LIMIT) {
-        lua_pushstring(L, "soft");
-      } else {
-        lua_pushstring(L, "hard");
-      }
-      lua_settable(L, -3);
+  word = ubrk_first(iterators->words);
+  line = ubrk_first(iterators->lines);
+  while (word != UBRK_DONE || line != UBRK_DONE) {
+    int32_t index;
+    int type;
+    if (line != UBRK_DONE) {
+      int32_t status = ubrk_getRuleStatus(iterators->lines);
+      lineType = (status >= UBRK_LINE_SOFT && status < UBRK_LINE_SOFT_LIMIT) ? BREAK_LINE_SOFT : BREAK_LINE_HARD;
+    }
+    if (line != UBRK_DONE && (word == UBRK_DONE || line <= word)) {
+      index = line;
+      type = lineType;
+    } else {
+      index = word;
+      type = BREAK_WORD;
     }
-    lua_pushstring(L, "token");
-    lua_pushlstring(L, input+previous, utf8_index-previous);
-
-    lua_settable(L, -3);
 
-    previous = utf8_index;
+    callback(L, index, type, previous, data);
+    previous = index;
     breakcount++;
-    i++;
+
+    if (word == index) word = ubrk_next(iterators->words);
+    if (line == index) line = ubrk_next(iterators->lines);
   }
-  ubrk_close(wordbreaks);
-  ubrk_close(linebreaks);
+
+  utext_close(&text);
   return breakcount;
 }
 
+static void push_breakpoint_table(lua_State *L, int32_t index, int type, int32_t previous, void* data) {
+  const char* input = (const char*)data;
+  lua_checkstack(L, 3);
+  lua_createtable(L, 0, 4);
+  lua_pushstring(L, type == BREAK_WORD ? "word" : "line");
+  lua_setfield(L, -2, "type");
+  lua_pushinteger(L, index);
+  lua_setfield(L, -2, "index");
+  if (type != BREAK_WORD) {
+    lua_pushstring(L, type == BREAK_LINE_SOFT ? "soft" : "hard");
+    lua_setfield(L, -2, "subtype");
+  }
+  lua_pushlstring(L, input + previous, index - previous);
+  lua_setfield(L, -2, "token");
+}
+
+int je_icu_breakpoints(lua_State *L) {
+  size_t input_l;
+  const char* input = luaL_checklstring(L, 1, &input_l);
+  const char* locale = luaL_checkstring(L, 2);
+  lua_settop(L, 2);
+  return each_breakpoint(L, input, input_l, locale, push_breakpoint_table, (void*)input);
+}
+
+static void store_packed_breakpoint(lua_State *L, int32_t index, int type, int32_t previous, void* data) {
+  lua_Integer n = ++*(lua_Integer*)data;
+  (void)previous;
+  lua_pushinteger(L, index);
+  lua_rawseti(L, 3, n);
+  lua_pushinteger(L, type);
+  lua_rawseti(L, 4, n);
+}
+
+/* Like breakpoints(), but returns two flat arrays instead of a table per
+boundary: the byte offsets of the boundaries, and their types as integers
+(1 for a word boundary, 2 for a soft line break, 3 for a hard line break). */
+int je_icu_breakpoints_packed(lua_State *L) {
+  size_t input_l;
+  const char* input = luaL_checklstring(L, 1, &input_l);
+  const char* locale = luaL_checkstring(L, 2);
+  lua_Integer n = 0;
+  lua_settop(L, 2);
+  lua_newtable(L);
+  lua_newtable(L);
+  each_breakpoint(L, input, input_l, locale, store_packed_breakpoint, &n);
+  return 2;
+}
+
 int je_icu_canonicalize_language(lua_State *L) {
   const char* lang = luaL_checkstring(L, 1);
   char locale[200], minimized[200], result[200];
@@ -504,6 +589,7 @@ int je_icu_version(lua_State *L) {
 
 static const struct luaL_Reg lib_table [] = {
   {"breakpoints", je_icu_breakpoints},
+  {"breakpoints_packed", je_icu_breakpoints_packed},
   {"case", je_icu_case},
   {"bidi_runs", je_icu_bidi_runs},
   {"canonicalize_language", je_icu_canonicalize_language},
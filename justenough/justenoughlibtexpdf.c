@@ -11,26 +11,58 @@
 /* #define COMPAT53_PREFIX compat53 */
 #include "compat-5.3.h"
 
-pdf_doc *p = NULL;
-double height = 0.0;
+#define PDFDOC_MT "justenoughlibtexpdf.document"
+
+typedef struct {
+  pdf_doc *p;
+  double height;
+  int streaming;
+} je_pdf_document;
+
+/* libtexpdf keeps its device, font map and file state in globals, so only
+ * one document can be open at a time. Once it is finished another can be
+ * opened from the same process. */
+static je_pdf_document *opened = NULL;
 double precision = 65536.0;
-const char* producer = "SILE";
 
-#define ASSERT_PDF_OPENED(p) \
-  if (!p) { \
-    luaL_error(L, "PDF object not initialized!"); \
-    return 0; \
-  }
+static je_pdf_document* check_document(lua_State *L) {
+  je_pdf_document *doc = (je_pdf_document*)luaL_checkudata(L, 1, PDFDOC_MT);
+  if (!doc->p)
+    luaL_error(L, "PDF document is already finished");
+  return doc;
+}
+
+static void close_document(je_pdf_document *doc) {
+  texpdf_files_close();
+  texpdf_close_device  ();
+  texpdf_close_document(doc->p);
+  texpdf_close_fontmaps();
+  doc->p = NULL;
+  if (opened == doc)
+    opened = NULL;
+}
 
-int je_pdf_init (lua_State *L) {
+int je_pdf_open (lua_State *L) {
   pdf_rect mediabox;
+  je_pdf_document *doc;
   const char* fn = luaL_checkstring(L, 1);
   double w = luaL_checknumber(L, 2);
-  height = luaL_checknumber(L, 3);
+  double height = luaL_checknumber(L, 3);
   const char* producer = luaL_checkstring(L, 4);
+  int streaming = lua_toboolean(L, 5);
+
+  if (opened)
+    return luaL_error(L, "Another PDF document is still open");
 
-  p = texpdf_open_document(fn, 0, w, height, 0,0,0);
-  texpdf_init_device(p, 1/precision, 2, 0);
+  doc = (je_pdf_document*)lua_newuserdata(L, sizeof(je_pdf_document));
+  doc->p = NULL;
+  doc->height = height;
+  doc->streaming = streaming;
+  luaL_setmetatable(L, PDFDOC_MT);
+
+  doc->p = texpdf_open_document(fn, 0, w, height, 0,0,0);
+  opened = doc;
+  texpdf_init_device(doc->p, 1/precision, 2, 0);
 
   mediabox.llx = 0.0;
   mediabox.lly = 0.0;
@@ -39,46 +71,57 @@ int je_pdf_init (lua_State *L) {
   texpdf_files_init();
   texpdf_init_fontmaps();
   texpdf_tt_aux_set_always_embed();
-  texpdf_doc_set_mediabox(p, 0, &mediabox);
-  texpdf_add_dict(p->info,
+  texpdf_doc_set_mediabox(doc->p, 0, &mediabox);
+  texpdf_add_dict(doc->p->info,
                texpdf_new_name("Producer"),
                texpdf_new_string(producer, strlen(producer)));
-  return 0;
+  return 1;
 }
 
+/* Ending a page makes libtexpdf write out and free the page's content
+ * stream and resource dictionary; only the page dictionary (needed for the
+ * page tree), fonts and images are kept until the document is closed. In
+ * streaming mode we also push what was written through to the file so that
+ * finished pages do not sit in stdio buffers either. */
 int je_pdf_endpage(lua_State *L) {
-  ASSERT_PDF_OPENED(p);
-  texpdf_doc_end_page(p);
+  je_pdf_document *doc = check_document(L);
+  texpdf_doc_end_page(doc->p);
+  if (doc->streaming)
+    fflush(NULL);
   return 0;
 };
 
 int je_pdf_beginpage(lua_State *L) {
-  ASSERT_PDF_OPENED(p);
-  texpdf_doc_begin_page(p, 1,0,height);
+  je_pdf_document *doc = check_document(L);
+  texpdf_doc_begin_page(doc->p, 1,0,doc->height);
   return 0;
 }
 
 int je_pdf_changepagesize(lua_State *L) {
+  je_pdf_document *doc = check_document(L);
   pdf_rect mediabox;
 
-  double pageno = luaL_checknumber(L, 1);
-  mediabox.llx = luaL_checknumber(L, 2);
-  mediabox.lly = luaL_checknumber(L, 3);
-  mediabox.urx = luaL_checknumber(L, 4);
-  mediabox.ury = luaL_checknumber(L, 5);
+  double pageno = luaL_checknumber(L, 2);
+  mediabox.llx = luaL_checknumber(L, 3);
+  mediabox.lly = luaL_checknumber(L, 4);
+  mediabox.urx = luaL_checknumber(L, 5);
+  mediabox.ury = luaL_checknumber(L, 6);
 
-  ASSERT_PDF_OPENED(p);
-
-  texpdf_doc_set_mediabox(p, pageno, &mediabox);
+  texpdf_doc_set_mediabox(doc->p, pageno, &mediabox);
   return 0;
 }
 
 int je_pdf_finish(lua_State *L) {
-  ASSERT_PDF_OPENED(p);
-  texpdf_files_close();
-  texpdf_close_device  ();
-  texpdf_close_document(p);
-  texpdf_close_fontmaps();
+  close_document(check_document(L));
+  return 0;
+}
+
+/* A document that is collected without being finished is still closed, so
+ * that the library is ready for the next one. */
+int je_pdf_gc(lua_State *L) {
+  je_pdf_document *doc = (je_pdf_document*)luaL_checkudata(L, 1, PDFDOC_MT);
+  if (doc->p)
+    close_document(doc);
   return 0;
 }
 
@@ -92,7 +135,8 @@ int je_pdf_loadfont(lua_State *L) {
   int embolden = 0;
   int font_id;
 
-  if (!lua_istable(L, 1)) return 0;
+  check_document(L);
+  if (!lua_istable(L, 2)) return 0;
 
   lua_pushstring(L, "tempfilename");
   lua_gettable(L, -2);
@@ -145,54 +189,59 @@ int je_pdf_loadfont(lua_State *L) {
 }
 
 int je_pdf_setdirmode(lua_State *L) {
-  int layout_dir = luaL_checkinteger(L,1);
+  int layout_dir;
+  check_document(L);
+  layout_dir = luaL_checkinteger(L, 2);
   texpdf_dev_set_dirmode(layout_dir);
   return 0;
 }
 
 int je_pdf_setstring(lua_State *L) {
-  double x = luaL_checknumber(L, 1);
-  double y = luaL_checknumber(L, 2);
-  const char*  s = luaL_checkstring(L, 3);
-  int    chrlen  = luaL_checkinteger(L, 4);
-  int    font_id = luaL_checkinteger(L, 5);
-  double w = luaL_checknumber(L,6);
-  ASSERT_PDF_OPENED(p);
-  texpdf_dev_set_string(p, precision * x, precision * (-height+y), s, chrlen, w * precision, font_id, -1);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double x = luaL_checknumber(L, 2);
+  double y = luaL_checknumber(L, 3);
+  const char*  s = luaL_checkstring(L, 4);
+  int    chrlen  = luaL_checkinteger(L, 5);
+  int    font_id = luaL_checkinteger(L, 6);
+  double w = luaL_checknumber(L, 7);
+  texpdf_dev_set_string(p, precision * x, precision * (-doc->height+y), s, chrlen, w * precision, font_id, -1);
   return 0;
 }
 
 int je_pdf_setrule(lua_State *L) {
-  double x = luaL_checknumber(L, 1);
-  double y = luaL_checknumber(L, 2);
-  double w = luaL_checknumber(L, 3);
-  double h = luaL_checknumber(L, 4);
-  ASSERT_PDF_OPENED(p);
-  texpdf_dev_set_rule(p, precision * x, precision * (-height+y), precision * w, precision * h);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double x = luaL_checknumber(L, 2);
+  double y = luaL_checknumber(L, 3);
+  double w = luaL_checknumber(L, 4);
+  double h = luaL_checknumber(L, 5);
+  texpdf_dev_set_rule(p, precision * x, precision * (-doc->height+y), precision * w, precision * h);
   return 0;
 }
 
 /* Colors */
 
 int je_pdf_colorpush_rgb(lua_State *L) {
-  double r = luaL_checknumber(L, 1);
-  double g = luaL_checknumber(L, 2);
-  double b = luaL_checknumber(L, 3);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double r = luaL_checknumber(L, 2);
+  double g = luaL_checknumber(L, 3);
+  double b = luaL_checknumber(L, 4);
   pdf_color color;
 
-  ASSERT_PDF_OPENED(p);
   texpdf_color_rgbcolor(&color, r, g, b);
   texpdf_color_push(p, &color, &color);
   return 0;
     }
 
 int je_pdf_colorpush_cmyk(lua_State *L) {
-  double c = luaL_checknumber(L, 1);
-  double m = luaL_checknumber(L, 2);
-  double y = luaL_checknumber(L, 3);
-  double k = luaL_checknumber(L, 4);
-
-  ASSERT_PDF_OPENED(p);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double c = luaL_checknumber(L, 2);
+  double m = luaL_checknumber(L, 3);
+  double y = luaL_checknumber(L, 4);
+  double k = luaL_checknumber(L, 5);
 
   pdf_color color;
   texpdf_color_cmykcolor(&color, c, m, y, k);
@@ -201,56 +250,57 @@ int je_pdf_colorpush_cmyk(lua_State *L) {
     }
 
 int je_pdf_colorpush_gray(lua_State *L) {
-  double l = luaL_checknumber(L, 1);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double l = luaL_checknumber(L, 2);
   pdf_color color;
 
-  ASSERT_PDF_OPENED(p);
-
   texpdf_color_graycolor(&color, l);
   texpdf_color_push(p, &color, &color);
   return 0;
     }
 
 int je_pdf_setcolor_rgb(lua_State *L) {
-  double r = luaL_checknumber(L, 1);
-  double g = luaL_checknumber(L, 2);
-  double b = luaL_checknumber(L, 3);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double r = luaL_checknumber(L, 2);
+  double g = luaL_checknumber(L, 3);
+  double b = luaL_checknumber(L, 4);
   pdf_color color;
 
-  ASSERT_PDF_OPENED(p);
-
   texpdf_color_rgbcolor(&color, r, g, b);
   texpdf_color_set(p, &color, &color);
   return 0;
 }
 
 int je_pdf_setcolor_cmyk(lua_State *L) {
-  double c = luaL_checknumber(L, 1);
-  double m = luaL_checknumber(L, 2);
-  double y = luaL_checknumber(L, 3);
-  double k = luaL_checknumber(L, 4);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double c = luaL_checknumber(L, 2);
+  double m = luaL_checknumber(L, 3);
+  double y = luaL_checknumber(L, 4);
+  double k = luaL_checknumber(L, 5);
   pdf_color color;
 
-  ASSERT_PDF_OPENED(p);
-
   texpdf_color_cmykcolor(&color, c, m, y, k);
   texpdf_color_set(p, &color, &color);
   return 0;
 }
 
 int je_pdf_setcolor_gray(lua_State *L) {
-  double l = luaL_checknumber(L, 1);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  double l = luaL_checknumber(L, 2);
   pdf_color color;
 
-  ASSERT_PDF_OPENED(p);
-
   texpdf_color_graycolor(&color, l);
   texpdf_color_set(p, &color, &color);
   return 0;
 }
 
 int je_pdf_colorpop(lua_State *L) {
-  ASSERT_PDF_OPENED(p);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
   texpdf_color_pop(p);
   return 0;
 }
@@ -258,12 +308,12 @@ int je_pdf_colorpop(lua_State *L) {
 /* PDF "specials" */
 
 int je_pdf_destination(lua_State *L) {
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
   pdf_obj* array = texpdf_new_array();
-  const char* name = luaL_checkstring(L, 1);
-  double x = luaL_checknumber(L, 2);
-  double y = luaL_checknumber(L, 3);
-
-  ASSERT_PDF_OPENED(p);
+  const char* name = luaL_checkstring(L, 2);
+  double x = luaL_checknumber(L, 3);
+  double y = luaL_checknumber(L, 4);
 
   texpdf_add_array(array, texpdf_doc_this_page_ref(p));
   texpdf_add_array(array, texpdf_new_name("XYZ"));
@@ -278,15 +328,16 @@ int je_pdf_destination(lua_State *L) {
 }
 
 int je_pdf_bookmark(lua_State *L) {
-  const char* dictionary = luaL_checkstring(L, 1);
-  int level = luaL_checknumber(L, 2);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  const char* dictionary = luaL_checkstring(L, 2);
+  int level = luaL_checknumber(L, 3);
   pdf_obj* dict = texpdf_parse_pdf_dict(&dictionary, dictionary + strlen(dictionary), NULL);
   int current_depth;
   if (!dict) {
     luaL_error(L, "Unparsable bookmark dictionary");
     return 0;
   }
-  ASSERT_PDF_OPENED(p);
   current_depth = texpdf_doc_bookmarks_depth(p);
   if (current_depth > level) {
     while (current_depth-- > level)
@@ -305,31 +356,33 @@ int je_pdf_begin_annotation(lua_State *L) {
 }
 
 int je_pdf_end_annotation(lua_State *L) {
-  const char* dictionary = luaL_checkstring(L, 1);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  const char* dictionary = luaL_checkstring(L, 2);
   pdf_rect rect;
   pdf_obj* dict;
 
-  rect.llx = luaL_checknumber(L, 2);
-  rect.lly = luaL_checknumber(L, 3);
-  rect.urx = luaL_checknumber(L, 4);
-  rect.ury = luaL_checknumber(L, 5);
+  rect.llx = luaL_checknumber(L, 3);
+  rect.lly = luaL_checknumber(L, 4);
+  rect.urx = luaL_checknumber(L, 5);
+  rect.ury = luaL_checknumber(L, 6);
 
   dict = texpdf_parse_pdf_dict(&dictionary, dictionary + strlen(dictionary), NULL);
   if (!dict) {
     luaL_error(L, "Unparsable annotation dictionary");
     return 0;
   }
-  ASSERT_PDF_OPENED(p);
   texpdf_doc_add_annot(p, texpdf_doc_current_page_number(p), &rect, dict, 1);
   texpdf_release_obj(dict);
   return 0;
 }
 
 int je_pdf_metadata(lua_State *L) {
-  const char* key = luaL_checkstring(L, 1);
-  const char* value = luaL_checkstring(L, 2);
-  int len = lua_rawlen(L, 2);
-  ASSERT(p);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  const char* key = luaL_checkstring(L, 2);
+  const char* value = luaL_checkstring(L, 3);
+  int len = lua_rawlen(L, 3);
   ASSERT(key);
   ASSERT(value);
   texpdf_add_dict(p->info,
@@ -340,13 +393,15 @@ int je_pdf_metadata(lua_State *L) {
 /* Images */
 
 int je_pdf_drawimage(lua_State *L) {
-  const char* filename = luaL_checkstring(L, 1);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  const char* filename = luaL_checkstring(L, 2);
   transform_info ti;
-  double x = luaL_checknumber(L, 2);
-  double y = luaL_checknumber(L, 3);
-  double w = luaL_checknumber(L, 4);
-  double h = luaL_checknumber(L, 5);
-  long page_no = (long)luaL_checkinteger(L, 6);
+  double x = luaL_checknumber(L, 3);
+  double y = luaL_checknumber(L, 4);
+  double w = luaL_checknumber(L, 5);
+  double h = luaL_checknumber(L, 6);
+  long page_no = (long)luaL_checkinteger(L, 7);
   int form_id = texpdf_ximage_findresource(p, filename, page_no, NULL);
 
   texpdf_transform_info_clear(&ti);
@@ -354,7 +409,6 @@ int je_pdf_drawimage(lua_State *L) {
   ti.height = h;
   ti.flags |= (INFO_HAS_WIDTH|INFO_HAS_HEIGHT);
 
-  ASSERT_PDF_OPENED(p);
   texpdf_dev_put_image(p, form_id, &ti, x, -h-y, 0);
   return 0;
 }
@@ -401,14 +455,15 @@ int je_pdf_imagebbox(lua_State *L) {
 }
 
 int je_pdf_transform(lua_State *L) {
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
   pdf_tmatrix matrix;
-  double a = luaL_checknumber(L, 1);
-  double b = luaL_checknumber(L, 2);
-  double c = luaL_checknumber(L, 3);
-  double d = luaL_checknumber(L, 4);
-  double e = luaL_checknumber(L, 5);
-  double f = luaL_checknumber(L, 6);
-  ASSERT_PDF_OPENED(p);
+  double a = luaL_checknumber(L, 2);
+  double b = luaL_checknumber(L, 3);
+  double c = luaL_checknumber(L, 4);
+  double d = luaL_checknumber(L, 5);
+  double e = luaL_checknumber(L, 6);
+  double f = luaL_checknumber(L, 7);
   texpdf_graphics_mode(p);
   pdf_setmatrix(&matrix, a,b,c,d,e,f);
   texpdf_dev_concat(p, &matrix);
@@ -416,23 +471,26 @@ int je_pdf_transform(lua_State *L) {
 }
 
 int je_pdf_gsave(lua_State *L)    {
-  ASSERT_PDF_OPENED(p);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
   texpdf_graphics_mode(p);
   texpdf_dev_gsave(p);
   return 0;
 }
 
 int je_pdf_grestore(lua_State *L) {
-  ASSERT_PDF_OPENED(p);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
   texpdf_graphics_mode(p);
   texpdf_dev_grestore(p);
   return 0;
 }
 
 int je_pdf_add_content(lua_State *L) {
-  const char* input = luaL_checkstring(L, 1);
-  int input_l = lua_rawlen(L, 1);
-  ASSERT_PDF_OPENED(p);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  const char* input = luaL_checkstring(L, 2);
+  int input_l = lua_rawlen(L, 2);
   texpdf_graphics_mode(p); /* Don't be mid-string! */
   texpdf_doc_add_page_content(p, " ", 1);
   texpdf_doc_add_page_content(p, input, input_l);
@@ -474,7 +532,9 @@ int je_pdf_release(lua_State *L) {
 }
 
 int je_pdf_get_dictionary(lua_State *L) {
-  const char* dict = luaL_checkstring(L, 1);
+  je_pdf_document *doc = check_document(L);
+  pdf_doc *p = doc->p;
+  const char* dict = luaL_checkstring(L, 2);
   pdf_obj *o = texpdf_doc_get_dictionary(p, dict);
   if (o) {
     lua_pushlightuserdata(L,o);
@@ -542,8 +602,7 @@ int je_pdf_version(lua_State *L) {
   return 1;
 }
 
-static const struct luaL_Reg lib_table [] = {
-  {"init", je_pdf_init},
+static const struct luaL_Reg document_methods [] = {
   {"beginpage", je_pdf_beginpage},
   {"change_page_size", je_pdf_changepagesize},
   {"endpage", je_pdf_endpage},
@@ -556,7 +615,6 @@ static const struct luaL_Reg lib_table [] = {
   {"setcolor_cmyk", je_pdf_setcolor_cmyk},
   {"setcolor_gray", je_pdf_setcolor_gray},
   {"drawimage", je_pdf_drawimage},
-  {"imagebbox", je_pdf_imagebbox},
   {"colorpop", je_pdf_colorpop},
   {"colorpush_rgb", je_pdf_colorpush_rgb},
   {"colorpush_cmyk", je_pdf_colorpush_cmyk},
@@ -569,9 +627,16 @@ static const struct luaL_Reg lib_table [] = {
   {"begin_annotation", je_pdf_begin_annotation},
   {"end_annotation", je_pdf_end_annotation},
   {"metadata", je_pdf_metadata},
-  {"version", je_pdf_version},
   {"add_content", je_pdf_add_content},
   {"get_dictionary", je_pdf_get_dictionary},
+  {NULL, NULL}
+};
+
+/* Functions that work on PDF objects or files rather than on a document */
+static const struct luaL_Reg lib_table [] = {
+  {"open", je_pdf_open},
+  {"imagebbox", je_pdf_imagebbox},
+  {"version", je_pdf_version},
   {"parse", je_pdf_parse},
   {"add_dict", je_pdf_add_dict},
   {"lookup_dictionary", je_pdf_lookup_dictionary},
@@ -585,6 +650,14 @@ static const struct luaL_Reg lib_table [] = {
 };
 
 int luaopen_justenoughlibtexpdf (lua_State *L) {
+  luaL_newmetatable(L, PDFDOC_MT);
+  lua_newtable(L);
+  luaL_setfuncs(L, document_methods, 0);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, je_pdf_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+
   lua_newtable(L);
   luaL_setfuncs(L, lib_table, 0);
   return 1;
@@ -164,26 +164,34 @@ function SILE.nodeMakers.unicode:letterspace ()
    end
 end
 
+-- ICU breakpoints come as two packed arrays: `chunks.indices` holds the byte
+-- offset of each boundary and `chunks.types` its kind (see below), with
+-- `chunks.cursor` pointing at the next boundary to compare against.
+local breakTypes = { "word", "line", "line" }
+local breakSubtypes = { nil, "soft", "hard" }
+
 function SILE.nodeMakers.unicode:isICUBreakHere (chunks, item)
-   return chunks[1] and (item.index >= chunks[1].index)
+   local index = chunks.indices[chunks.cursor]
+   return index and (item.index >= index)
 end
 
 function SILE.nodeMakers.unicode:handleICUBreak (chunks, item)
    -- The ICU library has told us there is a breakpoint at
    -- this index. We need to...
-   local bp = chunks[1]
-   -- ... remove this breakpoint (and any out of order ones)
-   -- from the ICU breakpoints array so that chunks[1] is
-   -- the next index point for comparison against the string...
-   while chunks[1] and item.index >= chunks[1].index do
-      table.remove(chunks, 1)
+   local type = chunks.types[chunks.cursor]
+   -- ... skip past this breakpoint (and any out of order ones)
+   -- so that the cursor points at the next index for comparison
+   -- against the string...
+   local indices = chunks.indices
+   while indices[chunks.cursor] and item.index >= indices[chunks.cursor] do
+      chunks.cursor = chunks.cursor + 1
    end
    -- ...decide which kind of breakpoint we have here and
    -- handle it appropriately.
-   if bp.type == "word" then
+   if breakTypes[type] == "word" then
       self:handleWordBreak(item)
-   elseif bp.type == "line" then
-      self:handleLineBreak(item, bp.subtype)
+   elseif breakTypes[type] == "line" then
+      self:handleLineBreak(item, breakSubtypes[type])
    end
    return chunks
 end
@@ -248,12 +256,21 @@ function SILE.nodeMakers.unicode:_handleLineBreakRepeatHyphen (item, subtype)
 end
 
 function SILE.nodeMakers.unicode:iterator (items)
-   local fulltext = ""
+   local texts = {}
    for i = 1, #items do
-      fulltext = fulltext .. items[i].text
+      texts[i] = items[i].text
+   end
+   local fulltext = table.concat(texts)
+   -- Use breakpoints found while shaping if they are for this same text
+   -- (language nodemakers may have altered the items since).
+   local indices, types
+   if self.breakpoints and self.breakpoints.text == fulltext then
+      indices, types = self.breakpoints.indices, self.breakpoints.types
+   else
+      indices, types = icu.breakpoints_packed(fulltext, self.options.language)
    end
-   local chunks = { icu.breakpoints(fulltext, self.options.language) }
-   table.remove(chunks, 1)
+   -- Skip the boundary at the start of the text
+   local chunks = { indices = indices, types = types, cursor = 2 }
    return coroutine.wrap(function ()
       local i
       i, self.items = self:handleInitialGlue(items)
@@ -4,9 +4,6 @@ local pdf = require("justenoughlibtexpdf")
 local cursorX = 0
 local cursorY = 0
 
-local started = false
-local lastkey = false
-
 local debugfont = SILE.font.loadDefaults({ family = "Gentium Plus", language = "en", size = 10 })
 
 local glyph2string = function (glyph)
@@ -15,8 +12,13 @@ end
 
 local _dl = 0.5
 
-local _debugfont
-local _font
+
+SILE.settings:declare({
+   parameter = "libtexpdf.streaming",
+   type = "boolean",
+   default = false,
+   help = "Flush each page to the output file as soon as it is finished",
+})
 
 local outputter = pl.class(base)
 outputter._name = "libtexpdf"
@@ -46,44 +48,54 @@ end
 -- function outputter:_init () end
 
 function outputter:_ensureInit ()
-   if not started then
+   if not self._pdf then
       local sheetSize = SILE.documentState.sheetSize or SILE.documentState.paperSize
       local w, h = sheetSize[1], sheetSize[2]
       local fname = self:getOutputFilename()
       -- Ideally we could want to set the PDF CropBox, BleedBox, TrimBox...
       -- Our wrapper only manages the MediaBox at this point.
-      pdf.init(fname == "-" and "/dev/stdout" or fname, w, h, SILE.full_version)
-      pdf.beginpage()
-      started = true
+      self._pdf = pdf.open(
+         fname == "-" and "/dev/stdout" or fname,
+         w,
+         h,
+         SILE.full_version,
+         SILE.settings:get("libtexpdf.streaming")
+      )
+      self._pdf:beginpage()
    end
 end
 
 function outputter:newPage ()
    self:_ensureInit()
-   pdf.endpage()
-   pdf.beginpage()
+   self._pdf:endpage()
+   self._pdf:beginpage()
 end
 
 -- pdf structure package needs a tie in here
 function outputter:_endHook () end
 
-function outputter.abort ()
-   if started then
-      pdf.endpage()
-      pdf.finish()
-      started = false
-      lastkey = false
+function outputter:_close ()
+   self._pdf:finish()
+   self._pdf = nil
+   self._lastkey = nil
+   self._font = nil
+   self._debugfont = nil
+   deltaX, deltaY = nil, nil
+end
+
+function outputter:abort ()
+   if self._pdf then
+      self._pdf:endpage()
+      self:_close()
    end
 end
 
 function outputter:finish ()
    -- allows generation of empty PDFs
    self:_ensureInit()
-   pdf.endpage()
+   self._pdf:endpage()
    self:runHooks("prefinish")
-   pdf.finish()
-   started = false
-   lastkey = false
+   self:_close()
 end
 
 function outputter.getCursor ()
@@ -101,39 +113,39 @@ end
 function outputter:setColor (color)
    self:_ensureInit()
    if color.r then
-      pdf.setcolor_rgb(color.r, color.g, color.b)
+      self._pdf:setcolor_rgb(color.r, color.g, color.b)
    end
    if color.c then
-      pdf.setcolor_cmyk(color.c, color.m, color.y, color.k)
+      self._pdf:setcolor_cmyk(color.c, color.m, color.y, color.k)
    end
    if color.l then
-      pdf.setcolor_gray(color.l)
+      self._pdf:setcolor_gray(color.l)
    end
 end
 
 function outputter:pushColor (color)
    self:_ensureInit()
    if color.r then
-      pdf.colorpush_rgb(color.r, color.g, color.b)
+      self._pdf:colorpush_rgb(color.r, color.g, color.b)
    end
    if color.c then
-      pdf.colorpush_cmyk(color.c, color.m, color.y, color.k)
+      self._pdf:colorpush_cmyk(color.c, color.m, color.y, color.k)
    end
    if color.l then
-      pdf.colorpush_gray(color.l)
+      self._pdf:colorpush_gray(color.l)
    end
 end
 
 function outputter:popColor ()
    self:_ensureInit()
-   pdf.colorpop()
+   self._pdf:colorpop()
 end
 
 function outputter:_drawString (str, width, x_offset, y_offset)
    local x, y = self:getCursor()
-   pdf.colorpush_rgb(0, 0, 0)
-   pdf.colorpop()
-   pdf.setstring(trueXCoord(x + x_offset), trueYCoord(y + y_offset), str, string.len(str), _font, width)
+   self._pdf:colorpush_rgb(0, 0, 0)
+   self._pdf:colorpop()
+   self._pdf:setstring(trueXCoord(x + x_offset), trueYCoord(y + y_offset), str, string.len(str), self._font, width)
 end
 
 function outputter:drawHbox (value, width)
@@ -168,36 +180,36 @@ function outputter:drawHbox (value, width)
 end
 
 function outputter:_withDebugFont (callback)
-   if not _debugfont then
-      _debugfont = self:setFont(debugfont)
+   if not self._debugfont then
+      self._debugfont = self:setFont(debugfont)
    end
-   local oldfont = _font
-   _font = _debugfont
+   local oldfont = self._font
+   self._font = self._debugfont
    callback()
-   _font = oldfont
+   self._font = oldfont
 end
 
 function outputter:setFont (options)
    self:_ensureInit()
    local key = SILE.font._key(options)
-   if lastkey and key == lastkey then
-      return _font
+   if self._lastkey and key == self._lastkey then
+      return self._font
    end
    local font = SILE.font.cache(options, SILE.shaper.getFace)
    if options.direction == "TTB" then
       font.layout_dir = 1
    end
    if SILE.typesetter.frame and SILE.typesetter.frame:writingDirection() == "TTB" then
-      pdf.setdirmode(1)
+      self._pdf:setdirmode(1)
    else
-      pdf.setdirmode(0)
+      self._pdf:setdirmode(0)
    end
-   _font = pdf.loadfont(font)
-   if _font < 0 then
+   self._font = self._pdf:loadfont(font)
+   if self._font < 0 then
       SU.error("Font loading error for " .. pl.pretty.write(options, ""))
    end
-   lastkey = key
-   return _font
+   self._lastkey = key
+   return self._font
 end
 
 function outputter:drawImage (src, x, y, width, height, pageno)
@@ -206,7 +218,7 @@ function outputter:drawImage (src, x, y, width, height, pageno)
    width = SU.cast("number", width)
    height = SU.cast("number", height)
    self:_ensureInit()
-   pdf.drawimage(src, trueXCoord(x), trueYCoord(y), width, height, pageno or 1)
+   self._pdf:drawimage(src, trueXCoord(x), trueYCoord(y), width, height, pageno or 1)
 end
 
 function outputter:getImageSize (src, pageno)
@@ -220,14 +232,14 @@ function outputter:drawSVG (figure, x, y, _, height, scalefactor)
    x = SU.cast("number", x)
    y = SU.cast("number", y)
    height = SU.cast("number", height)
-   pdf.add_content("q")
+   self._pdf:add_content("q")
    self:setCursor(x, y)
    x, y = self:getCursor()
    local sheetSize = SILE.documentState.sheetSize or SILE.documentState.paperSize
    local newy = y - SILE.documentState.paperSize[2] / 2 + height - sheetSize[2] / 2
-   pdf.add_content(table.concat({ scalefactor, 0, 0, -scalefactor, trueXCoord(x), newy, "cm" }, " "))
-   pdf.add_content(figure)
-   pdf.add_content("Q")
+   self._pdf:add_content(table.concat({ scalefactor, 0, 0, -scalefactor, trueXCoord(x), newy, "cm" }, " "))
+   self._pdf:add_content(figure)
+   self._pdf:add_content("Q")
 end
 
 function outputter:drawRule (x, y, width, height)
@@ -237,7 +249,7 @@ function outputter:drawRule (x, y, width, height)
    height = SU.cast("number", height)
    self:_ensureInit()
    local paperY = SILE.documentState.paperSize[2]
-   pdf.setrule(trueXCoord(x), trueYCoord(paperY - y - height), width, height)
+   self._pdf:setrule(trueXCoord(x), trueYCoord(paperY - y - height), width, height)
 end
 
 function outputter:debugFrame (frame)
@@ -289,12 +301,12 @@ function outputter:scaleFn (xorigin, yorigin, xratio, yratio, callback)
    local x0 = trueXCoord(xorigin)
    local y0 = -trueYCoord(yorigin)
    self:_ensureInit()
-   pdf:gsave()
-   pdf.setmatrix(1, 0, 0, 1, x0, y0)
-   pdf.setmatrix(xratio, 0, 0, yratio, 0, 0)
-   pdf.setmatrix(1, 0, 0, 1, -x0, -y0)
+   self._pdf:gsave()
+   self._pdf:setmatrix(1, 0, 0, 1, x0, y0)
+   self._pdf:setmatrix(xratio, 0, 0, yratio, 0, 0)
+   self._pdf:setmatrix(1, 0, 0, 1, -x0, -y0)
    callback()
-   pdf:grestore()
+   self._pdf:grestore()
 end
 
 function outputter:rotateFn (xorigin, yorigin, theta, callback)
@@ -303,12 +315,12 @@ function outputter:rotateFn (xorigin, yorigin, theta, callback)
    local x0 = trueXCoord(xorigin)
    local y0 = -trueYCoord(yorigin)
    self:_ensureInit()
-   pdf:gsave()
-   pdf.setmatrix(1, 0, 0, 1, x0, y0)
-   pdf.setmatrix(math.cos(theta), math.sin(theta), -math.sin(theta), math.cos(theta), 0, 0)
-   pdf.setmatrix(1, 0, 0, 1, -x0, -y0)
+   self._pdf:gsave()
+   self._pdf:setmatrix(1, 0, 0, 1, x0, y0)
+   self._pdf:setmatrix(math.cos(theta), math.sin(theta), -math.sin(theta), math.cos(theta), 0, 0)
+   self._pdf:setmatrix(1, 0, 0, 1, -x0, -y0)
    callback()
-   pdf:grestore()
+   self._pdf:grestore()
 end
 
 -- Other rotation unstable APIs
@@ -322,14 +334,14 @@ function outputter:enterFrameRotate (xa, xb, y, theta) -- Unstable API see rotat
    local cx1 = trueXCoord(xb)
    local cy = -trueYCoord(y)
    self:_ensureInit()
-   pdf:gsave()
-   pdf.setmatrix(1, 0, 0, 1, cx1, cy)
-   pdf.setmatrix(math.cos(theta), math.sin(theta), -math.sin(theta), math.cos(theta), 0, 0)
-   pdf.setmatrix(1, 0, 0, 1, -cx0, -cy)
+   self._pdf:gsave()
+   self._pdf:setmatrix(1, 0, 0, 1, cx1, cy)
+   self._pdf:setmatrix(math.cos(theta), math.sin(theta), -math.sin(theta), math.cos(theta), 0, 0)
+   self._pdf:setmatrix(1, 0, 0, 1, -cx0, -cy)
 end
 
 function outputter:leaveFrameRotate ()
-   pdf:grestore()
+   self._pdf:grestore()
 end
 
 -- Unstable link APIs
@@ -338,7 +350,7 @@ function outputter:setLinkAnchor (name, x, y)
    x = SU.cast("number", x)
    y = SU.cast("number", y)
    self:_ensureInit()
-   pdf.destination(name, trueXCoord(x), trueYCoord(y))
+   self._pdf:destination(name, trueXCoord(x), trueYCoord(y))
 end
 
 local function borderColor (color)
@@ -373,7 +385,7 @@ function outputter:startLink (_, _) -- destination, options as argument
    -- Sure thing is that some backends may need the destination here, e.g. an HTML backend
    -- would generate a <a href="#destination">, as well as the options possibly for styling
    -- on the link opening?
-   pdf.begin_annotation()
+   self._pdf:begin_annotation()
 end
 
 function outputter:endLink (dest, opts, x0, y0, x1, y1)
@@ -382,7 +394,7 @@ function outputter:endLink (dest, opts, x0, y0, x1, y1)
    local borderstyle = borderStyle(opts.borderstyle, borderwidth)
    local target = opts.external and "/Type/Action/S/URI/URI" or "/S/GoTo/D"
    local d = "<</Type/Annot/Subtype/Link" .. borderstyle .. bordercolor .. "/A<<" .. target .. "(" .. dest .. ")>>>>"
-   pdf.end_annotation(
+   self._pdf:end_annotation(
       d,
       trueXCoord(x0),
       trueYCoord(y0 - opts.borderoffset),
@@ -413,7 +425,7 @@ function outputter:setMetadata (key, value)
       value = SU.utf8_to_utf16be(value)
    end
    self:_ensureInit()
-   pdf.metadata(key, value)
+   self._pdf:metadata(key, value)
 end
 
 function outputter:setBookmark (dest, title, level)
@@ -424,13 +436,13 @@ function outputter:setBookmark (dest, title, level)
    local ustr = SU.utf8_to_utf16be_hexencoded(title)
    local d = "<</Title<" .. ustr .. ">/A<</S/GoTo/D(" .. dest .. ")>>>>"
    self:_ensureInit()
-   pdf.bookmark(d, level)
+   self._pdf:bookmark(d, level)
 end
 
 -- Assumes the caller known what they want to stuff in raw PDF format
 function outputter:drawRaw (literal)
    self:_ensureInit()
-   pdf.add_content(literal)
+   self._pdf:add_content(literal)
 end
 
 return outputter
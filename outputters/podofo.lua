@@ -61,11 +61,12 @@ end
 
 function outputter:drawHbox (value, _)
    local x, y = self:getCursor()
-   if not value.glyphNames then
+   local glyphNames = value.glyphNames or SILE.shaper.glyphNames and SILE.shaper:glyphNames(value)
+   if not glyphNames then
       return
    end
-   for i = 1, #value.glyphNames do
-      painter:DrawGlyph(document, x, y, value.glyphNames[i])
+   for i = 1, #glyphNames do
+      painter:DrawGlyph(document, x, y, glyphNames[i])
    end
 end
 
@@ -433,8 +433,10 @@ function package:_init ()
       while not vboxlist[lastbox].is_vbox do
          lastbox = lastbox - 1
       end
-      while not (vboxlist[i].is_penalty and vboxlist[i].penalty == -20000) do
-         table.insert(vboxlist, lastbox, SILE.types.node.penalty(-20000))
+      -- Move the rest of the list down once to make room for the penalties
+      table.move(vboxlist, lastbox, #vboxlist, i + 1)
+      for j = lastbox, i do
+         vboxlist[j] = SILE.types.node.penalty(-20000)
       end
       return target
    end
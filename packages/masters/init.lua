@@ -36,6 +36,7 @@ local function doswitch (frames)
       SILE.frames[id] = frame
       frame:invalidate()
    end
+   SILE.layoutFrames()
 end
 
 local function switchMasterOnePage (_, id)
@@ -25,15 +25,14 @@ local parallelPagebreak = function ()
       for j = 1, #thisPageFrames do
          local frame = thisPageFrames[j]
          local typesetter = typesetterPool[frame]
-         local thispage = {}
          SU.debug("parallel", "Dumping lines for page on typesetter", typesetter.id)
          if #typesetter.state.outputQueue > 0 and calculations[frame].mark == 0 then
             -- More than one page worth of stuff here.
             -- Just ship out one page and hope for the best.
             SILE.typesetters.base.buildPage(typesetter)
          else
-            for l = 1, calculations[frame].mark do
-               thispage[l] = table.remove(typesetter.state.outputQueue, 1)
+            local thispage = SU.shift(typesetter.state.outputQueue, calculations[frame].mark)
+            for l = 1, #thispage do
                SU.debug("parallel", thispage[l])
             end
             typesetter:outputLinesToPage(thispage)
@@ -81,8 +81,8 @@ function package:_init ()
    local stRoot = stNode("Document")
    stPointer = stRoot
    self:loadPackage("pdf")
-   SILE.outputter:registerHook("prefinish", function ()
-      local catalog = pdf.get_dictionary("Catalog")
+   SILE.outputter:registerHook("prefinish", function (outputter)
+      local catalog = outputter._pdf:get_dictionary("Catalog")
       local structureTree = pdf.parse("<< /Type /StructTreeRoot >>")
       pdf.add_dict(catalog, pdf.parse("/StructTreeRoot"), pdf.reference(structureTree))
       structureNumberTree = pdf.parse("<< /Nums [] >>")
@@ -106,7 +106,7 @@ function package:registerCommands ()
       if type(SILE.outputter._ensureInit) == "function" then
          SILE.outputter:_ensureInit()
       end
-      node.page = pdf.get_dictionary("@THISPAGE")
+      node.page = SILE.outputter._pdf:get_dictionary("@THISPAGE")
       node.mcid = mcid
       local oldstPointer = stPointer
       stPointer = node
@@ -18,27 +18,51 @@ function pagebuilder:collateVboxes (vboxlist)
    return output
 end
 
+-- A restart state left by a call that found no break can be resumed if the
+-- list has only grown at its end since, and the target is unchanged.
+function pagebuilder.resumable (_, restart, vboxlist, targetHeight)
+   return rawequal(restart.vboxlist, vboxlist)
+      and restart.targetHeight == targetHeight
+      and restart.i <= #vboxlist
+      and rawequal(vboxlist[1], restart.first)
+      and rawequal(vboxlist[restart.i], restart.last)
+end
+
 -- Note: Almost 1/3 of the time in a typical SILE in taken iterating through
 -- this function. As a result there are some micro-optimizations here that
 -- make it a-typical of preferred coding styles. In particular note that
--- we absolutize heavily iterated lengths as early as possible and make
--- make direct calls to their integer amounts, assumed to be in points by
--- the point they are called **without actually checking**!
+-- the total height is summed in a packed length, which absolutizes the
+-- heights as they are added and keeps plain numbers in points, and that
+-- the target is converted to points once (again after insertions).
+--
+-- When no break is found, the second value returned is the state of the
+-- scan before the last vbox (whose height the leading of the next line may
+-- still change): passing it back as the restart option with the same list
+-- continues from there, with the same result as a full rescan.
 function pagebuilder:findBestBreak (options)
    local vboxlist = SU.required(options, "vboxlist", "in findBestBreak")
    local target = SU.required(options, "target", "in findBestBreak", "length")
    local restart = options.restart or false
    local force = options.force or false
    local i = 0
-   local totalHeight = SILE.types.length()
+   local totalHeight = SILE.types.packedlength()
    local bestBreak = nil
    local started = false
-   if restart and restart.target == target then
-      totalHeight = restart.totalHeight
+   local targetHeight = target:tonumber()
+   local leastC = self.inf_bad
+   if restart and self:resumable(restart, vboxlist, targetHeight) then
+      totalHeight.length, totalHeight.stretch, totalHeight.shrink = restart.length, restart.stretch, restart.shrink
       i = restart.i
       started = restart.started
+      leastC = restart.leastC
+      bestBreak = restart.bestBreak
    end
-   local leastC = self.inf_bad
+   -- The state of the scan before the last vbox
+   local markI, markStarted, markLeastC, markBestBreak = i, started, leastC, bestBreak
+   local markLength, markStretch, markShrink = totalHeight.length, totalHeight.stretch, totalHeight.shrink
+   -- Breaks already rated against a target that an insertion has since
+   -- reduced would be rated differently by a full rescan
+   local restartable = true
    SU.debug("pagebuilder", function ()
       return "Page builder for frame "
          .. SILE.typesetter.frame.id
@@ -68,16 +92,22 @@ function pagebuilder:findBestBreak (options)
       local vbox = vboxlist[i]
       SU.debug("pagebuilder", "Dealing with VBox", vbox)
       if vbox.is_vbox then
-         totalHeight:___add(vbox.height)
-         totalHeight:___add(vbox.depth)
+         markI, markStarted, markLeastC, markBestBreak = i - 1, started, leastC, bestBreak
+         markLength, markStretch, markShrink = totalHeight.length, totalHeight.stretch, totalHeight.shrink
+         totalHeight:add(vbox.height)
+         totalHeight:add(vbox.depth)
       elseif vbox.is_vglue then
-         totalHeight:___add(vbox.height)
+         totalHeight:add(vbox.height)
       elseif vbox.is_insertion then
          -- TODO: refactor as hook and without side effects!
-         target = SILE.insertions.processInsertion(vboxlist, i, totalHeight, target)
+         target = SILE.insertions.processInsertion(vboxlist, i, totalHeight:tolength(), target)
+         if target:tonumber() ~= targetHeight then
+            targetHeight = target:tonumber()
+            restartable = false
+         end
          vbox = vboxlist[i]
       end
-      local left = target - totalHeight
+      local left = targetHeight - totalHeight.length
       SU.debug("pagebuilder", "I have", left, "left")
       -- if left < -20 then SU.error("\nCatastrophic page breaking failure!"); end
       pi = 0
@@ -90,13 +120,13 @@ function pagebuilder:findBestBreak (options)
       then
          local badness
          SU.debug("pagebuilder", "totalHeight", totalHeight, "with target", target)
-         if totalHeight.length.amount < target.length.amount then -- TeX #1039
+         if totalHeight.length < targetHeight then -- TeX #1039
             -- Account for infinite stretch?
-            badness = SU.rateBadness(self.inf_bad, left.length.amount, totalHeight.stretch.amount)
-         elseif left.length.amount < totalHeight.shrink.amount then
+            badness = SU.rateBadness(self.inf_bad, left, totalHeight.stretch)
+         elseif left < totalHeight.shrink then
             badness = self.awful_bad
          else
-            badness = SU.rateBadness(self.inf_bad, -left.length.amount, totalHeight.shrink.amount)
+            badness = SU.rateBadness(self.inf_bad, -left, totalHeight.shrink)
          end
 
          local c
@@ -114,20 +144,15 @@ function pagebuilder:findBestBreak (options)
          if c < leastC then
             leastC = c
             bestBreak = i
-         else
-            restart = { totalHeight = totalHeight, i = i, started = started, target = target }
          end
 
          SU.debug("pagebuilder", "Badness:", c)
          if c == self.awful_bad or pi <= self.eject_penalty then
             SU.debug("pagebuilder", "outputting")
-            local onepage = {}
             if not bestBreak then
                bestBreak = i
             end
-            for j = 1, bestBreak do
-               onepage[j] = table.remove(vboxlist, 1)
-            end
+            local onepage = SU.shift(vboxlist, bestBreak)
             while #onepage > 1 and onepage[#onepage].discardable do
                onepage[#onepage] = nil
             end
@@ -137,13 +162,25 @@ function pagebuilder:findBestBreak (options)
    end
    SU.debug("pagebuilder", "No page break here")
    if force and bestBreak then
-      local onepage = {}
-      for j = 1, bestBreak do
-         onepage[j] = table.remove(vboxlist, 1)
-      end
-      return onepage, pi
+      return SU.shift(vboxlist, bestBreak), pi
+   end
+   if not restartable then
+      return false, false
    end
-   return false, restart
+   return false,
+      {
+         vboxlist = vboxlist,
+         i = markI,
+         first = vboxlist[1],
+         last = vboxlist[markI],
+         started = markStarted,
+         length = markLength,
+         stretch = markStretch,
+         shrink = markShrink,
+         targetHeight = targetHeight,
+         leastC = markLeastC,
+         bestBreak = markBestBreak,
+      }
 end
 
 return pagebuilder
@@ -65,10 +65,7 @@ function pagebuilder:findBestBreak (options)
          end
       end
       if badness > 0 then
-         local onepage = {}
-         for j = 1, bestBreak do
-            onepage[j] = table.remove(vboxlist, 1)
-         end
+         local onepage = SU.shift(vboxlist, bestBreak)
          while #onepage > 1 and onepage[#onepage].discardable do
             onepage[#onepage] = nil
          end
@@ -0,0 +1,267 @@
+--- SILE optimal pagebuilder class.
+-- Chooses page breaks the way the line breaker chooses line breaks: instead of taking the first acceptable break, it
+-- waits until the output queue holds a few pages of material (or a forced break), finds the sequence of breaks over
+-- those pages with the least total demerits, and ships out only the first page of it. Widow, orphan and other
+-- penalties in the vertical list count towards the demerits, and insertions are counted against the page they fall
+-- on. Select it with `\use[module=pagebuilders.optimal]`.
+-- @interfaces pagebuilders
+
+local base = require("pagebuilders.base")
+
+local pagebuilder = pl.class(base)
+pagebuilder._name = "optimal"
+
+function pagebuilder:_init ()
+   base._init(self)
+   -- Added to the badness of every page, so that fewer pages are preferred
+   self.pagePenalty = 10
+   self:declareSettings()
+end
+
+function pagebuilder.declareSettings (_)
+   SILE.settings:declare({
+      parameter = "pagebuilder.lookahead",
+      type = "integer",
+      default = 4,
+      help = "Number of pages of material the optimal page builder looks at before choosing a page break",
+   })
+end
+
+local scratch = SILE.types.packedlength()
+
+-- How much an insertion not yet placed will take from the current frame.
+local function insertionHeight (node)
+   local classes = SILE.scratch.insertions and SILE.scratch.insertions.classes
+   local class = classes and classes[node.class]
+   local ratio = class and class.stealFrom and class.stealFrom[SILE.typesetter.frame.id]
+   if node.seen or not ratio then
+      return 0
+   end
+   return scratch:set(node.contentHeight):add(node.contentDepth).length * ratio
+end
+
+-- Fill the metrics of nodes from up to to: cumulative heights, stretch and
+-- shrink in points, the number of vboxes, and the penalty of each legal
+-- break (false elsewhere), as the base page builder rates them.
+local function measure (self, metrics, vboxlist, from, to)
+   local height, stretch, shrink = metrics.height, metrics.stretch, metrics.shrink
+   local boxes, penalty = metrics.boxes, metrics.penalty
+   for i = from, to do
+      local node = vboxlist[i]
+      height[i], stretch[i], shrink[i], boxes[i] = height[i - 1], stretch[i - 1], shrink[i - 1], boxes[i - 1]
+      if node.is_vbox then
+         scratch:set(node.height):add(node.depth)
+         height[i] = height[i] + scratch.length
+         stretch[i] = stretch[i] + scratch.stretch
+         shrink[i] = shrink[i] + scratch.shrink
+         boxes[i] = boxes[i] + 1
+         metrics.mark = i - 1
+      elseif node.is_vglue then
+         scratch:set(node.height)
+         height[i] = height[i] + scratch.length
+         stretch[i] = stretch[i] + scratch.stretch
+         shrink[i] = shrink[i] + scratch.shrink
+      elseif node.is_insertion then
+         height[i] = height[i] + insertionHeight(node)
+      end
+      if node.is_penalty and node.penalty < self.inf_bad then
+         penalty[i] = node.penalty
+         if node.penalty <= self.eject_penalty and not metrics.forced then
+            metrics.forced = i
+         end
+      elseif node.is_vglue and i > 1 and not vboxlist[i - 1].discardable then
+         penalty[i] = 0
+      else
+         penalty[i] = false
+      end
+   end
+end
+
+-- Metrics of the queue, carried over from the last call when the queue has
+-- only grown since. Nodes from the one before the last vbox on are measured
+-- again, as the leading of the next line may change that vbox.
+function pagebuilder:metrics (vboxlist, targetHeight, restart)
+   local metrics
+   if restart and self:resumable(restart, vboxlist, targetHeight) then
+      metrics = restart.metrics
+      if metrics.forced and metrics.forced > restart.i then
+         metrics.forced = nil
+      end
+      metrics.mark = restart.i
+      measure(self, metrics, vboxlist, restart.i + 1, #vboxlist)
+   else
+      metrics = {
+         height = { [0] = 0 },
+         stretch = { [0] = 0 },
+         shrink = { [0] = 0 },
+         boxes = { [0] = 0 },
+         penalty = {},
+         mark = 0,
+      }
+      measure(self, metrics, vboxlist, 1, #vboxlist)
+   end
+   return metrics
+end
+
+-- Badness of a page as rated by the base page builder.
+function pagebuilder:pageBadness (height, stretch, shrink, targetHeight)
+   local left = targetHeight - height
+   if height < targetHeight then
+      return SU.rateBadness(self.inf_bad, left, stretch)
+   elseif left < shrink then
+      return self.awful_bad
+   end
+   return SU.rateBadness(self.inf_bad, -left, shrink)
+end
+
+function pagebuilder:pageDemerits (badness, pi)
+   local demerits = (self.pagePenalty + badness) ^ 2
+   if pi > 0 then
+      demerits = demerits + pi * pi
+   elseif pi > self.eject_penalty then
+      demerits = demerits - pi * pi
+   end
+   return demerits
+end
+
+-- Find the end of the first page of the best sequence of pages over the
+-- nodes up to last, which ends the sequence if final. The pages that may
+-- end at a break all start after one of a window of earlier breaks, which
+-- slides on as pages from its oldest break become overfull, so the time
+-- taken is linear in the number of nodes.
+function pagebuilder:bestFirstPage (metrics, vboxlist, last, final, targetHeight)
+   local height, stretch, shrink = metrics.height, metrics.stretch, metrics.shrink
+   local boxes, penalty = metrics.boxes, metrics.penalty
+   -- Breaks considered so far: where they are, where the page after them
+   -- starts, the least demerits of pages up to them and the break before
+   local at, start, total, previous = { 0 }, {}, { 0 }, { false }
+   local first = 1
+   local function pageStart (i)
+      i = i + 1
+      while i <= last and vboxlist[i].is_vglue do
+         i = i + 1
+      end
+      return i
+   end
+   start[1] = pageStart(0)
+   for i = 1, last do
+      local pi = penalty[i]
+      if pi then
+         local best, bestTotal = nil, math.huge
+         local j = first
+         while j <= #at do
+            local from = start[j] - 1
+            if not total[j] then
+               -- No sequence of pages ends there
+               if j == first then
+                  first = first + 1
+               end
+            elseif boxes[i] > boxes[from] then
+               local badness = self:pageBadness(
+                  height[i] - height[from],
+                  stretch[i] - stretch[from],
+                  shrink[i] - shrink[from],
+                  targetHeight
+               )
+               if badness >= self.awful_bad then
+                  -- Pages from here on only get longer
+                  if j == first then
+                     first = first + 1
+                  end
+               else
+                  local demerits = total[j] + self:pageDemerits(badness, pi)
+                  if demerits < bestTotal then
+                     best, bestTotal = j, demerits
+                  end
+               end
+            end
+            j = j + 1
+         end
+         local n = #at + 1
+         at[n], start[n], total[n], previous[n] = i, pageStart(i), best and bestTotal, best or false
+         if pi <= self.eject_penalty then
+            first = n
+         end
+      end
+   end
+   -- The sequence ends at the last break if it is final, or else at the best
+   -- break after which less than a page is left
+   local finish
+   if final then
+      finish = at[#at] == last and total[#at] and #at
+   else
+      local bestTotal = math.huge
+      for j = #at, 2, -1 do
+         local from = start[j] - 1
+         if height[last] - height[from] > targetHeight then
+            break
+         end
+         if total[j] and total[j] < bestTotal then
+            finish, bestTotal = j, total[j]
+         end
+      end
+   end
+   if not finish then
+      return nil
+   end
+   while previous[finish] and previous[finish] ~= 1 do
+      finish = previous[finish]
+   end
+   return at[finish]
+end
+
+function pagebuilder:findBestBreak (options)
+   local vboxlist = SU.required(options, "vboxlist", "in findBestBreak")
+   local target = SU.required(options, "target", "in findBestBreak", "length")
+   if options.force then
+      return base.findBestBreak(self, options)
+   end
+   local targetHeight = target:tonumber()
+   local metrics = self:metrics(vboxlist, targetHeight, options.restart)
+   local count = #vboxlist
+   local lookahead = SILE.settings:get("pagebuilder.lookahead") * targetHeight
+   local last, final = metrics.forced, true
+   if not last and metrics.height[count] < lookahead then
+      SU.debug("pagebuilder", "Waiting for more material with", metrics.height[count], "of", lookahead)
+      return false,
+         {
+            vboxlist = vboxlist,
+            i = metrics.mark,
+            first = vboxlist[1],
+            last = vboxlist[metrics.mark],
+            targetHeight = targetHeight,
+            metrics = metrics,
+         }
+   end
+   if not last or metrics.height[last] > lookahead then
+      -- Look no further than the lookahead
+      last, final = last or count, false
+      while last > 1 and metrics.height[last - 1] >= lookahead do
+         last = last - 1
+      end
+   end
+   local pageEnd = self:bestFirstPage(metrics, vboxlist, last, final, targetHeight)
+   if not pageEnd then
+      SU.debug("pagebuilder", "No feasible sequence of pages, breaking the first page greedily")
+      return base.findBestBreak(self, { vboxlist = vboxlist, target = target })
+   end
+   SU.debug("pagebuilder", "Best first page ends at node", pageEnd, "of", count)
+   -- Let the base page builder ship out the page, so that insertions on it
+   -- are placed as usual, and put back whatever they pushed off it
+   local page = SU.shift(vboxlist, pageEnd)
+   local eject = SILE.types.node.penalty(self.eject_penalty)
+   page[#page + 1] = eject
+   local onepage, pi = base.findBestBreak(self, { vboxlist = page, target = target })
+   if #page == 0 then
+      pi = metrics.penalty[pageEnd] or 0
+   elseif rawequal(page[#page], eject) then
+      page[#page] = nil
+   end
+   if #page > 0 then
+      table.move(vboxlist, 1, #vboxlist, #page + 1)
+      table.move(page, 1, #page, 1, vboxlist)
+   end
+   return onepage, pi
+end
+
+return pagebuilder
@@ -128,9 +128,30 @@ end
 
 function shaper:preAddNodes (_, _) end
 
-function shaper:createNnodes (token, options)
+-- Called once the document is finished, e.g. to report statistics
+function shaper:finish () end
+
+-- Shape a token that is about to be turned into nodes. Shapers that can find
+-- its break opportunities in the same pass may return them as well, see
+-- SILE.nodeMakers.unicode:iterator().
+function shaper:shapeTokenForNodes (token, options)
+   return self:shapeToken(token, options), nil
+end
+
+-- Shape the texts of the unshaped nodes of a paragraph together, given as a
+-- list of tables with `text` and `options`. Shapers that can return, for each,
+-- a table with the `items` and `breakpoints` shapeTokenForNodes would; others
+-- return nothing and each node is shaped on its own.
+function shaper:shapeTokensForNodes (_) end
+
+function shaper:createNnodes (token, options, shaped)
    options.tracking = SILE.settings:get("shaper.tracking")
-   local items, _ = self:shapeToken(token, options)
+   local items, breakpoints
+   if shaped then
+      items, breakpoints = shaped.items, shaped.breakpoints
+   else
+      items, breakpoints = self:shapeTokenForNodes(token, options)
+   end
    if #items < 1 then
       return {}
    end
@@ -138,7 +159,9 @@ function shaper:createNnodes (token, options)
    SILE.languageSupport.loadLanguage(lang)
    local nodeMaker = SILE.nodeMakers[lang] or SILE.nodeMakers.unicode
    local nodes = {}
-   for node in nodeMaker(options):iterator(items, token) do
+   local maker = nodeMaker(options)
+   maker.breakpoints = breakpoints
+   for node in maker:iterator(items, token) do
       table.insert(nodes, node)
    end
    return nodes
@@ -103,7 +103,8 @@ function shaper:shapeToken (text, options)
       local _index
       for _, item in ipairs(candidate_items) do
          item.fontOptions = run.options
-         if item.gid == 0 or item.name == ".null" or item.name == ".notdef" then
+         local name = item.gid ~= 0 and self:glyphName(run.options, item.gid)
+         if item.gid == 0 or name == ".null" or name == ".notdef" then
             SU.debug("font-fallback", function ()
                return ("Glyph %s not found in %s"):format(item.text, face)
             end)
@@ -1,24 +1,155 @@
 local hb = require("justenoughharfbuzz")
 local icu = require("justenoughicu")
 local bitshim = require("bitshim")
+local lfs = require("lfs")
+local zlib = require("zlib")
 
 local base = require("shapers.base")
 
-local smallTokenSize = 20 -- Small words will be cached
-local shapeCache = {}
-local _key = function (options, text)
-   return table.concat({
-      text,
-      options.tracking or "1",
-      options.language,
-      options.script,
-      SILE.font._key(options),
-   }, ";")
+-- Shaped tokens are cached per font, keyed by an interned font id rather than
+-- a serialisation of the font options. The id is looked up by walking a tree
+-- of the option values, which avoids building a key string for every token.
+local shapeCache
+local fontIds = {}
+local lastFontId = 0
+local _id = {}
+
+local _intern = function (node, value)
+   if value == nil then
+      value = false
+   end
+   local child = node[value]
+   if not child then
+      child = {}
+      node[value] = child
+   end
+   return child
+end
+
+local _fontId = function (options)
+   local size = options.size
+   if type(size) ~= "number" then
+      size = SILE.types.measurement(size):tonumber()
+   end
+   local node = _intern(fontIds, options.tracking or 1)
+   node = _intern(node, options.language)
+   node = _intern(node, options.script)
+   node = _intern(node, options.family or "")
+   node = _intern(node, size)
+   node = _intern(node, tonumber(options.weight) or 0)
+   node = _intern(node, options.style)
+   node = _intern(node, options.variant)
+   node = _intern(node, options.features)
+   node = _intern(node, options.variations)
+   node = _intern(node, options.direction)
+   node = _intern(node, options.filename or "")
+   if not node[_id] then
+      lastFontId = lastFontId + 1
+      node[_id] = lastFontId
+   end
+   return node[_id]
 end
 
 local substwarnings = {}
 local usedfonts = {}
 
+-- Persistent cache of instantiated variable fonts. Files are named after a
+-- checksum of the font file's path, size and modification time plus the face
+-- index and pinned axis coordinates, so they can be shared between documents
+-- and runs without reading the font. Recency is tracked with the files'
+-- modification times, which are bumped on every hit.
+local instanceCache = {}
+
+local _checksum = function (data)
+   return ("%08x%08x"):format(zlib.crc32()(data), zlib.adler32()(data))
+end
+
+function instanceCache.key (face)
+   local coords = { hb.get_var_coords(face) }
+   if #coords == 0 then
+      return nil
+   end
+   local attr = lfs.attributes(face.filename)
+   if not attr then
+      return nil
+   end
+   local stamp = ("%s:%d:%d"):format(face.filename, attr.size, attr.modification)
+   for i = 1, #coords do
+      coords[i] = ("%g"):format(coords[i])
+   end
+   local pins = tostring(face.index or 0) .. ":" .. table.concat(coords, ",")
+   return _checksum(stamp) .. "-" .. _checksum(pins)
+end
+
+function instanceCache.dir ()
+   local dir = SILE.settings:get("harfbuzz.instancecache")
+   if not dir or dir == "" then
+      return nil
+   end
+   if lfs.attributes(dir, "mode") ~= "directory" and not pl.dir.makepath(dir) then
+      return nil
+   end
+   return dir
+end
+
+function instanceCache.get (dir, key)
+   local path = pl.path.join(dir, key .. ".ttf")
+   if lfs.attributes(path, "mode") == "file" then
+      lfs.touch(path)
+      return path
+   end
+end
+
+function instanceCache.put (dir, key, data)
+   local path = pl.path.join(dir, key .. ".ttf")
+   local tmp = path .. ".tmp"
+   local file = io.open(tmp, "wb")
+   if not file then
+      return nil
+   end
+   file:write(data)
+   file:close()
+   if not os.rename(tmp, path) then
+      os.remove(tmp)
+      return nil
+   end
+   instanceCache.evict(dir, path)
+   return path
+end
+
+-- Remove least recently used instances until the cache fits its size limit,
+-- never removing the one just written.
+function instanceCache.evict (dir, keep)
+   local limit = SILE.settings:get("harfbuzz.instancecachesize")
+   local entries, total = {}, 0
+   for name in lfs.dir(dir) do
+      if name:match("%.ttf$") then
+         local path = pl.path.join(dir, name)
+         local attr = lfs.attributes(path)
+         if attr and attr.mode == "file" then
+            total = total + attr.size
+            entries[#entries + 1] = { path = path, size = attr.size, time = attr.modification }
+         end
+      end
+   end
+   if total <= limit then
+      return
+   end
+   table.sort(entries, function (a, b)
+      return a.time < b.time
+   end)
+   for _, entry in ipairs(entries) do
+      if total <= limit then
+         break
+      end
+      if entry.path ~= keep then
+         SU.debug("fonts", "Evicting cached instance", entry.path)
+         os.remove(entry.path)
+         total = total - entry.size
+      end
+   end
+end
+
 local shaper = pl.class(base)
 shaper._name = "harfbuzz"
 
@@ -29,16 +160,101 @@ function shaper:declareSettings ()
       default = "",
       help = "Comma-separated shaper list to pass to Harfbuzz",
    })
+   SILE.settings:declare({
+      parameter = "harfbuzz.shapecachesize",
+      type = "integer",
+      default = 200000,
+      help = "Maximum number of shaped glyphs kept in the shaping cache, 0 to disable caching",
+   })
+   SILE.settings:declare({
+      parameter = "harfbuzz.instancecache",
+      type = "string or nil",
+      default = "",
+      help = "Directory in which to cache instantiated variable fonts between runs (e.g. sile/instances under $XDG_CACHE_HOME), empty (the default) to disable",
+   })
+   SILE.settings:declare({
+      parameter = "harfbuzz.instancecachesize",
+      type = "integer",
+      default = 256 * 1024 * 1024,
+      help = "Size limit in bytes for the variable font instance cache",
+   })
 end
 
-function shaper:shapeToken (text, options)
-   local items
-   if #text < smallTokenSize then
-      items = shapeCache[_key(options, text)]
-      if items then
-         return items
+local _cacheFor = function ()
+   local capacity = SILE.settings:get("harfbuzz.shapecachesize")
+   if not shapeCache then
+      shapeCache = SU.lru(capacity)
+   elseif shapeCache.capacity ~= capacity then
+      shapeCache:resize(capacity)
+   end
+   return shapeCache
+end
+
+-- Glyphs shaped for nodes stay in their native glyph run. Their items only
+-- hold the text and byte offset of their cluster; every other field is read
+-- through the run's accessors when asked for, as a field of the item.
+local _glyphFields = {
+   gid = true,
+   width = true,
+   glyphAdvance = true,
+   height = true,
+   depth = true,
+   x_bearing = true,
+   glyphWidth = true,
+}
+
+local _glyphItem = {
+   __index = function (item, field)
+      local run = rawget(item, "glyphrun")
+      if field == "x_offset" or field == "y_offset" then
+         -- Left out of item tables when zero
+         local offset = run[field](run, item.glyph)
+         return offset ~= 0 and offset or nil
+      elseif _glyphFields[field] then
+         return run[field](run, item.glyph)
+      end
+   end,
+}
+
+-- Turn a shaped glyph run into items, attaching to each the slice of text its
+-- cluster covers. Clusters are byte offsets into text and the last cluster
+-- runs to stop.
+local _itemsFromRun = function (run, text, stop, options)
+   local items = {}
+   local count = #run
+   local nextIndex = count > 0 and run:index(1)
+   for i = 1, count do
+      local index = nextIndex
+      nextIndex = i < count and run:index(i + 1)
+      local item = setmetatable({
+         glyphrun = run,
+         glyph = i,
+         index = index,
+         text = text:sub(index + 1, nextIndex or stop), -- Lua strings are 1-indexed
+      }, _glyphItem)
+      if options.tracking then
+         item.width = run:width(i) * options.tracking
       end
+      items[i] = item
    end
+   return items
+end
+
+-- Plain item tables, for callers of shapeToken that keep or change them.
+local _itemTables = function (items)
+   local tables = {}
+   for i = 1, #items do
+      local item = items[i]
+      local glyph = item.glyphrun:glyph(item.glyph)
+      glyph.index = item.index
+      glyph.text = item.text
+      glyph.width = item.width
+      tables[i] = glyph
+   end
+   return tables
+end
+
+function shaper:_faceFor (options)
    local face = SILE.font.cache(options, self.getFace)
    if not face then
       SU.error("Could not find requested font " .. options .. " or any suitable substitutes")
@@ -53,29 +269,213 @@ function shaper:shapeToken (text, options)
       SU.warn("Font family '" .. options.family .. "' not available, falling back to '" .. face.family .. "'")
    end
    usedfonts[face] = true
-   items = {
-      hb._shape(
-         text,
-         face,
-         options.script,
-         options.direction,
-         options.language,
-         face.pointsize,
-         options.features,
-         SILE.settings:get("harfbuzz.subshapers") or ""
-      ),
+   return face
+end
+
+local _run = function (face, options)
+   return {
+      face = face,
+      script = options.script,
+      direction = options.direction,
+      language = options.language,
+      pointsize = face.pointsize,
+      features = options.features,
+      shapers = SILE.settings:get("harfbuzz.subshapers") or "",
    }
+end
+
+-- Shape a token into items read from their glyph run, through the cache.
+function shaper:_shapeGlyphs (text, options)
+   local cache = _cacheFor()
+   local fontId = _fontId(options)
+   local items = cache:get(fontId, text)
+   if items then
+      return items
+   end
+   local run = _run(self:_faceFor(options), options)
+   run.text = text
+   items = _itemsFromRun(hb._shape_batch({ run })[1], text, #text, options)
+   -- Weigh entries by glyph count, plus one so that empty results count too
+   cache:set(fontId, text, items, #items + 1)
+   return items
+end
+
+function shaper:shapeToken (text, options)
+   return _itemTables(self:_shapeGlyphs(text, options))
+end
+
+--- Shape a paragraph made of several font runs, resolving bidi levels and
+-- finding break opportunities in the same native pass.
+-- @tparam string text The paragraph.
+-- @tparam table runs List of tables with `start` (0-based byte offset), `length` (bytes) and font `options`.
+-- @tparam[opt] table options `direction` of the paragraph, whether to resolve `bidi` levels (default true) and the
+-- locale to use for `breaks` (default the language of the first run).
+-- @treturn table Segments in logical order, each with `run` (index into runs), `start`, `length`, bidi `level`,
+-- `direction` and shaped `items`.
+-- @treturn table Breakpoints in the form used by `SILE.nodeMakers.unicode`.
+function shaper:shapeParagraph (text, runs, options)
+   local hbruns = {}
+   for i, run in ipairs(runs) do
+      hbruns[i] = _run(self:_faceFor(run.options), run.options)
+      hbruns[i].start = run.start
+      hbruns[i].length = run.length
+   end
+   local segments, indices, types = hb._shape_paragraph(text, hbruns, options)
+   for _, segment in ipairs(segments) do
+      segment.items = _itemsFromRun(segment.glyphs, text, segment.start + segment.length, runs[segment.run].options)
+      segment.glyphs = nil
+   end
+   return segments, { text = text, indices = indices, types = types }
+end
+
+function shaper:shapeTokenForNodes (token, options)
+   -- Shapers built on this one that customize shapeToken (e.g. font fallback)
+   -- must keep going through it.
+   if self.shapeToken ~= shaper.shapeToken then
+      return self:shapeToken(token, options)
+   end
+   local shaped = self:shapeTokensForNodes({ { text = token, options = options } })
+   return shaped[1].items, shaped[1].breakpoints
+end
+
+-- The break opportunities of one run, out of those of its paragraph. The run
+-- starts with a boundary like the paragraph does, as the node maker skips it.
+local _runBreakpoints = function (breakpoints, text, start)
+   local stop = start + #text
+   local indices, types = { 0 }, { breakpoints.types[1] }
+   for i = 1, #breakpoints.indices do
+      local index = breakpoints.indices[i]
+      if index > stop then
+         break
+      elseif index > start then
+         indices[#indices + 1] = index - start
+         types[#types + 1] = breakpoints.types[i]
+      end
+   end
+   return { text = text, indices = indices, types = types }
+end
+
+-- HarfBuzz looks at up to five characters either side of a run in its
+-- paragraph (HB_BUFFER_MAX_CONTEXT_LENGTH), so runs shaped in a paragraph are
+-- cached under their text together with that context.
+local _contextLength = 5
+
+local _isContinuation = function (text, i)
+   local byte = text:byte(i)
+   return byte and byte >= 0x80 and byte < 0xC0
+end
+
+local _contextBefore = function (text, stop)
+   local start = stop + 1
+   for _ = 1, _contextLength do
+      if start <= 1 then
+         break
+      end
+      start = start - 1
+      while start > 1 and _isContinuation(text, start) do
+         start = start - 1
+      end
+   end
+   return text:sub(start, stop)
+end
+
+local _contextAfter = function (text, start)
+   local stop = start - 1
+   for _ = 1, _contextLength do
+      if stop >= #text then
+         break
+      end
+      stop = stop + 1
+      while _isContinuation(text, stop + 1) do
+         stop = stop + 1
+      end
+   end
+   return text:sub(start, stop)
+end
+
+local _cacheKey = function (text, before, after)
+   if before == "" and after == "" then
+      return text
+   end
+   return before .. "\0" .. text .. "\0" .. after
+end
+
+-- Callers get their own list of the cached items, as node makers may change it
+local _copyItems = function (items)
+   local copy = {}
    for i = 1, #items do
-      local j = (i == #items) and #text or items[i + 1].index
-      items[i].text = text:sub(items[i].index + 1, j) -- Lua strings are 1-indexed
-      if options.tracking then
-         items[i].width = items[i].width * options.tracking
+      copy[i] = items[i]
+   end
+   return copy
+end
+
+--- Shape the texts of the unshaped nodes of a paragraph in one native call, finding their break opportunities with
+-- the context of the whole paragraph. Texts found in the cache with the same context keep the items and break
+-- opportunities they were cached with.
+-- @tparam table tokens List of tables with the `text` and font `options` of each node.
+-- @treturn table|nil For each token shaped, a table with its `items` and `breakpoints` (which may be nil), as
+-- `shapeTokenForNodes` returns them; nil if this shaper cannot shape them together.
+function shaper:shapeTokensForNodes (tokens)
+   if self.shapeToken ~= shaper.shapeToken then
+      return nil
+   end
+   local cache = _cacheFor()
+   local tracking = SILE.settings:get("shaper.tracking")
+   -- The whole paragraph is shaped, so that every run sees its real neighbours
+   local shaped, texts, starts, length = {}, {}, {}, 0
+   for i, token in ipairs(tokens) do
+      token.options.tracking = tracking
+      starts[i] = length
+      texts[#texts + 1] = token.text
+      length = length + #token.text
+   end
+   local text = table.concat(texts)
+   local runs, keys = {}, {}
+   for i, token in ipairs(tokens) do
+      local start, stop = starts[i], starts[i] + #token.text
+      keys[i] = _cacheKey(token.text, _contextBefore(text, start), _contextAfter(text, stop + 1))
+      local items = cache:get(_fontId(token.options), keys[i])
+      if items or #token.text == 0 then
+         items = items or {}
+         shaped[i] = { items = _copyItems(items), breakpoints = items.breakpoints }
+      else
+         runs[#runs + 1] = { start = start, length = #token.text, options = token.options, token = i }
       end
    end
-   if #text < smallTokenSize then
-      shapeCache[_key(options, text)] = items
+   if #runs == 0 then
+      return shaped
+   end
+   -- The bidi package has already split nodes into runs of one direction
+   local language = runs[1].options.language
+   local segments, breakpoints = self:shapeParagraph(
+      text,
+      runs,
+      { direction = runs[1].options.direction, bidi = false, breaks = language }
+   )
+   -- Without bidi there is one segment per run
+   for _, segment in ipairs(segments) do
+      local run = runs[segment.run]
+      local token = tokens[run.token]
+      local items = segment.items
+      for i = 1, #items do
+         items[i].index = items[i].index - run.start
+      end
+      if token.options.language == language then
+         items.breakpoints = _runBreakpoints(breakpoints, token.text, run.start)
+      end
+      -- Weigh entries by glyph count, plus one so that empty results count too
+      cache:set(_fontId(token.options), keys[run.token], items, #items + 1)
+      shaped[run.token] = { items = _copyItems(items), breakpoints = items.breakpoints }
+   end
+   return shaped
+end
+
+function shaper:finish ()
+   if shapeCache then
+      SU.debug("shapecache", function ()
+         return "Shaping cache: " .. shapeCache:stats()
+      end)
    end
-   return items
 end
 
 local _pretty_varitions = function (face)
@@ -108,13 +508,25 @@ function shaper.getFace (opts)
    -- Try instantiating the font, hb.instantiate() will return nil if it is not
    -- a variable font or if instantiation failed.
    face.tempfilename = face.filename
-   local data = hb.instantiate(face)
-   if data then
-      local tmp = os.tmpname()
-      local file = io.open(tmp, "wb")
-      file:write(data)
-      file:close()
-      face.tempfilename = tmp
+   local cacheDir = instanceCache.dir()
+   local cacheKey = cacheDir and instanceCache.key(face)
+   local cached = cacheKey and instanceCache.get(cacheDir, cacheKey)
+   local data = not cached and hb.instantiate(face)
+   if cached then
+      face.tempfilename = cached
+      face.tempfilecached = true
+      SU.debug("fonts", "Reusing cached instance of", _pretty_varitions(face), "from", face.tempfilename)
+   elseif data then
+      local path = cacheKey and instanceCache.put(cacheDir, cacheKey, data)
+      if path then
+         face.tempfilecached = true
+      else
+         path = os.tmpname()
+         local file = io.open(path, "wb")
+         file:write(data)
+         file:close()
+      end
+      face.tempfilename = path
       SU.debug("fonts", "Instantiated", _pretty_varitions(face), "as", face.tempfilename)
    elseif (face.variations ~= "") or (bitshim.rshift(face.index, 16) ~= 0) then
       if not SILE.features.font_variations then
@@ -140,7 +552,17 @@ end
 
 function shaper:preAddNodes (items, nnodeValue) -- Check for complex nodes
    for i = 1, #items do
-      if items[i].y_offset or items[i].x_offset or items[i].width ~= items[i].glyphAdvance then
+      local item = items[i]
+      local run = rawget(item, "glyphrun")
+      local complex
+      if run then
+         local j = item.glyph
+         local width = rawget(item, "width") or run:width(j)
+         complex = run:x_offset(j) ~= 0 or run:y_offset(j) ~= 0 or width ~= run:glyphAdvance(j)
+      else
+         complex = item.y_offset or item.x_offset or item.width ~= item.glyphAdvance
+      end
+      if complex then
          nnodeValue.complex = true
          break
       end
@@ -159,11 +581,26 @@ function shaper:addShapedGlyphToNnodeValue (nnodevalue, shapedglyph)
    if not nnodevalue.glyphString then
       nnodevalue.glyphString = {}
    end
-   if not nnodevalue.glyphNames then
-      nnodevalue.glyphNames = {}
+   local run = rawget(shapedglyph, "glyphrun")
+   table.insert(nnodevalue.glyphString, run and run:gid(shapedglyph.glyph) or shapedglyph.gid)
+end
+
+-- Glyph names are not collected while shaping; callers that need them (e.g.
+-- the podofo outputter or font fallback) look them up on demand.
+function shaper:glyphName (options, gid)
+   local face = SILE.font.cache(options, self.getFace)
+   return hb.get_glyph_name(face, gid)
+end
+
+function shaper:glyphNames (nnodevalue)
+   if not nnodevalue.glyphNames and nnodevalue.glyphString then
+      local names = {}
+      for i = 1, #nnodevalue.glyphString do
+         names[i] = self:glyphName(nnodevalue.options, nnodevalue.glyphString[i])
+      end
+      nnodevalue.glyphNames = names
    end
-   table.insert(nnodevalue.glyphString, shapedglyph.gid)
-   table.insert(nnodevalue.glyphNames, shapedglyph.name)
+   return nnodevalue.glyphNames
 end
 
 function shaper:debugVersions ()
@@ -77,4 +77,100 @@ describe("SILE.linebreak", function ()
    it("should sleuth the right break point", function ()
       -- print(SILE.linebreak:doBreak(hlist, 30.0))
    end)
+
+   describe("native line breaker", function ()
+      local function breakWith (native, hsize, threads)
+         local positions = {}
+         SILE.settings:temporarily(function ()
+            SILE.settings:set("linebreak.native", native)
+            SILE.settings:set("linebreak.memoSize", 0)
+            SILE.settings:set("linebreak.threads", threads or 1)
+            local breaks = SILE.linebreak:doBreak(pl.tablex.copy(hlist), SILE.types.measurement(hsize))
+            for i, brk in ipairs(breaks) do
+               positions[i] = brk.position
+            end
+         end)
+         return positions
+      end
+
+      it("should find the same breaks as the Lua line breaker", function ()
+         for _, hsize in ipairs({ 120, 200, 345 }) do
+            assert.is.same(breakWith(false, hsize), breakWith(true, hsize))
+         end
+      end)
+
+      it("should find the same breaks with speculative emergency passes", function ()
+         SILE.settings:temporarily(function ()
+            SILE.settings:set("linebreak.pretolerance", -1)
+            SILE.settings:set("linebreak.tolerance", 50)
+            SILE.settings:set("linebreak.emergencyStretch", SILE.types.measurement("20pt"))
+            for _, hsize in ipairs({ 120, 200, 345 }) do
+               assert.is.same(breakWith(false, hsize), breakWith(true, hsize, 2))
+            end
+         end)
+      end)
+   end)
+
+   describe("windowed breaking", function ()
+      local function breakInWindows (windowSize, hsize)
+         local positions = {}
+         SILE.settings:temporarily(function ()
+            SILE.settings:set("linebreak.windowSize", windowSize)
+            SILE.settings:set("linebreak.memoSize", 0)
+            local nodes = pl.tablex.copy(hlist)
+            local breaks = SILE.linebreak:doBreak(nodes, SILE.types.measurement(hsize))
+            if windowSize > 0 then
+               assert.is.same(hlist, nodes)
+            end
+            for i, brk in ipairs(breaks) do
+               positions[i] = brk.position
+            end
+         end)
+         return positions
+      end
+
+      it("should find the same breaks as breaking the whole paragraph", function ()
+         for _, hsize in ipairs({ 120, 200, 345 }) do
+            local whole = breakInWindows(0, hsize)
+            for _, windowSize in ipairs({ 20, 30, 40 }) do
+               assert.is.same(whole, breakInWindows(windowSize, hsize))
+            end
+         end
+      end)
+   end)
+
+   describe("paragraph memo", function ()
+      local function breakPositions (hsize)
+         local positions = {}
+         local breaks = SILE.linebreak:doBreak(pl.tablex.copy(hlist), SILE.types.measurement(hsize))
+         for i, brk in ipairs(breaks) do
+            positions[i] = brk.position
+         end
+         return positions
+      end
+
+      setup(function ()
+         SILE.settings:set("linebreak.memoSize", 100)
+      end)
+
+      teardown(function ()
+         SILE.settings:set("linebreak.memoSize", 0)
+      end)
+
+      it("should replay the breaks of an identical paragraph", function ()
+         local memo = SILE.linebreak:memo()
+         local first = breakPositions(200)
+         local hits = memo.hits
+         assert.is.same(first, breakPositions(200))
+         assert.is.equal(hits + 1, memo.hits)
+      end)
+
+      it("should not replay breaks for a different width", function ()
+         local memo = SILE.linebreak:memo()
+         breakPositions(210)
+         local hits = memo.hits
+         breakPositions(220)
+         assert.is.equal(hits, memo.hits)
+      end)
+   end)
 end)
@@ -21,6 +21,25 @@ describe("The fontconfig manager", function ()
       assert.is.equal(family, face.family)
    end)
 
+   it("should memoize and persist matches", function ()
+      local fc = SILE.fontManager.fontconfig
+      local first = fc._face({ family = "Libertinus Serif", size = 10 })
+      local second = fc._face({ family = "libertinus serif", size = 10 })
+      assert.is.equal(first.filename, second.filename)
+      assert.is.equal(first.family, second.family)
+      local path = os.tmpname()
+      SILE.settings:temporarily(function ()
+         SILE.settings:set("font.matchcache", path)
+         SILE.fontManager:face({ family = "Libertinus Serif", size = 10 })
+         SILE.fontManager:finish()
+      end)
+      local fh = io.open(path, "r")
+      local contents = fh:read("*a")
+      fh:close()
+      os.remove(path)
+      assert.is.truthy(contents:find(first.filename, 1, true))
+   end)
+
    -- Disable running this test unless we have font variation support. The test itself does not need the feature, but we
    -- have *fonts* in the test data set that do and fontconfig is not deterministic about which fallback we might get
    -- for an unknown font. In this case a font that needs variation support is being returned in some CI environments
@@ -17,4 +17,62 @@ describe("The frame factory", function ()
          assert.is.equal(180, frame:height():tonumber())
       end)
    end)
+
+   describe("Changed", function ()
+      it("should follow its changed constraints", function ()
+         local frame = SILE.newFrame({ id = "changed", top = 20, left = 30, bottom = 200, right = 300 })
+         assert.is.equal(270, frame:width():tonumber())
+         frame:constrain("right", 400)
+         assert.is.equal(370, frame:width():tonumber())
+         frame:relax("left")
+         frame:constrain("width", 100)
+         assert.is.equal(300, frame:left():tonumber())
+      end)
+
+      it("should follow a frame it depends on being replaced", function ()
+         SILE.newFrame({ id = "above", top = 0, left = 0, bottom = 100, right = 100 })
+         local frame = SILE.newFrame({ id = "below", top = "bottom(above)", left = 0, bottom = 300, right = 100 })
+         assert.is.equal(200, frame:height():tonumber())
+         SILE.newFrame({ id = "above", top = 0, left = 0, bottom = 150, right = 100 })
+         assert.is.equal(150, frame:height():tonumber())
+      end)
+   end)
+
+   describe("Layout", function ()
+      local function newPage ()
+         SILE.frames = { page = SILE.newFrame({ id = "page", left = 0, top = 0, right = 400, bottom = 600 }) }
+         SILE.newFrame({ id = "content", left = 20, right = "right(page) - 20", top = 20, bottom = "top(footer)" })
+         SILE.newFrame({ id = "footer", left = 20, right = 380, bottom = 580, height = 30 })
+         SILE.layoutFrames()
+      end
+
+      it("should be the same on a page with the same frames", function ()
+         newPage()
+         assert.is.equal(530, SILE.getFrame("content"):height():tonumber())
+         newPage()
+         assert.is.equal(530, SILE.getFrame("content"):height():tonumber())
+         assert.is.equal(360, SILE.getFrame("content"):width():tonumber())
+      end)
+
+      it("should follow relative units in its constraints", function ()
+         local function marginPage ()
+            SILE.frames = { page = SILE.newFrame({ id = "page", left = 0, top = 0, right = 400, bottom = 600 }) }
+            SILE.newFrame({ id = "margin", left = 0, width = "2em", top = 0, bottom = 600 })
+            SILE.layoutFrames()
+            return SILE.getFrame("margin"):width():tonumber()
+         end
+         SILE.settings:temporarily(function ()
+            SILE.settings:set("font.size", 10)
+            assert.is.equal(20, marginPage())
+            SILE.settings:set("font.size", 12)
+            assert.is.equal(24, marginPage())
+         end)
+      end)
+
+      it("should follow frames changed during the page", function ()
+         newPage()
+         SILE.getFrame("footer"):constrain("height", 80)
+         assert.is.equal(480, SILE.getFrame("content"):height():tonumber())
+      end)
+   end)
 end)
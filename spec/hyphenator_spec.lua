@@ -42,4 +42,59 @@ describe("Hyphenation module", function ()
          assert.is.equal("Légè-rement", hyphenate("Légèrement", "fr"))
       end)
    end)
+
+   describe("word cache", function ()
+      it("should reuse results for repeated words", function ()
+         local cache = SILE._hyphenators["fr"].cache
+         hyphenate("complètement", "fr")
+         local hits = cache.hits
+         assert.is.equal("com-plè-te-ment", hyphenate("complètement", "fr"))
+         assert.is.equal(hits + 1, cache.hits)
+      end)
+
+      it("should not reuse results across hyphenation minima", function ()
+         assert.is.equal("com-plè-te-ment", hyphenate("complètement", "fr"))
+         SILE._hyphenators["fr"].leftmin = 4
+         assert.is.equal("complè-te-ment", hyphenate("complètement", "fr"))
+         SILE._hyphenators["fr"].leftmin = 2
+      end)
+   end)
+
+   describe("compiled patterns", function ()
+      local native = require("justenoughhyphen")
+      local patterns = { ".hy3ph", "he2n", "hena4", "hen5at", "1na", "n2at", "1tio", "2io", "o2n", "1p2h" }
+
+      local function split (compiled, word)
+         local pieces, last = {}, 0
+         for _, offset in ipairs({ compiled:hyphenate(word, word:lower(), 2, 2) }) do
+            pieces[#pieces + 1] = word:sub(last + 1, offset)
+            last = offset
+         end
+         pieces[#pieces + 1] = word:sub(last + 1)
+         return table.concat(pieces, "-")
+      end
+
+      it("should hyphenate like the Lua trie", function ()
+         local compiled = native.compile(patterns)
+         assert.is.equal("hy-phen-ation", split(compiled, "hyphenation"))
+         assert.is.equal("Hy-phen-ation", split(compiled, "Hyphenation"))
+      end)
+
+      it("should load from a cache file", function ()
+         local path = os.tmpname()
+         assert.is.truthy(native.compile(patterns):save(path))
+         local compiled = native.open(path)
+         os.remove(path)
+         assert.is.equal("hy-phen-ation", split(compiled, "hyphenation"))
+      end)
+
+      it("should reject other files", function ()
+         local path = os.tmpname()
+         local file = io.open(path, "wb")
+         file:write("not compiled patterns")
+         file:close()
+         assert.is.falsy(native.open(path))
+         os.remove(path)
+      end)
+   end)
 end)
@@ -0,0 +1,93 @@
+SILE = require("core.sile")
+
+describe("SILE.pagebuilder", function ()
+   local pagebuilder = SILE.pagebuilders.default()
+   local target = SILE.types.measurement(100)
+
+   -- Add lines to the queue a few at a time, as the typesetter does after
+   -- each paragraph, and collect the heights of the pages built.
+   local function buildPages (queue, lines, withRestart)
+      local pages, restart = {}, nil
+      for i = 1, #lines do
+         if #queue > 0 then
+            queue[#queue + 1] = SILE.types.node.vglue(SILE.types.length("2pt plus 1pt minus 0.5pt"))
+         end
+         queue[#queue + 1] = SILE.types.node.vbox({ height = lines[i], depth = 2 })
+         if i % 3 == 0 then
+            queue[#queue + 1] = SILE.types.node.penalty(i % 2 == 0 and 50 or -50)
+         end
+         local page, res = pagebuilder:findBestBreak({ vboxlist = queue, target = target, restart = restart })
+         if page then
+            pages[#pages + 1] = #page
+            restart = nil
+         elseif withRestart then
+            restart = res
+         end
+      end
+      return pages
+   end
+
+   it("should build the same pages when restarting from the last call", function ()
+      local lines = {}
+      for i = 1, 60 do
+         lines[i] = 8 + (i * 7) % 5
+      end
+      local full = buildPages({}, lines, false)
+      assert.is.truthy(#full > 2)
+      assert.is.same(full, buildPages({}, lines, true))
+   end)
+
+   it("should not restart on a queue that was changed", function ()
+      local queue = {
+         SILE.types.node.vbox({ height = 40, depth = 2 }),
+         SILE.types.node.vbox({ height = 40, depth = 2 }),
+      }
+      local page, restart = pagebuilder:findBestBreak({ vboxlist = queue, target = target })
+      assert.is.falsy(page)
+      assert.is.truthy(restart)
+      table.insert(queue, 1, SILE.types.node.vbox({ height = 40, depth = 2 }))
+      queue[#queue + 1] = SILE.types.node.penalty(0)
+      page = pagebuilder:findBestBreak({ vboxlist = queue, target = target, restart = restart })
+      assert.is.equal(3, #page)
+   end)
+
+   describe("optimal", function ()
+      local optimal = SILE.pagebuilders.optimal()
+
+      it("should ship out every line, in order, on pages that fit", function ()
+         local queue, restart, pages = {}, nil, {}
+         local function build ()
+            local page, res = optimal:findBestBreak({ vboxlist = queue, target = target, restart = restart })
+            restart = not page and res or nil
+            pages[#pages + 1] = page or nil
+            return page
+         end
+         for i = 1, 60 do
+            if #queue > 0 then
+               queue[#queue + 1] = SILE.types.node.vglue(SILE.types.length("2pt plus 1pt"))
+            end
+            queue[#queue + 1] = SILE.types.node.vbox({ height = 8 + (i * 7) % 5, depth = 2, line = i })
+            if i % 4 == 0 then
+               build()
+            end
+         end
+         queue[#queue + 1] = SILE.types.node.vglue(SILE.types.length("0pt plus 1000pt"))
+         queue[#queue + 1] = SILE.types.node.penalty(-20000)
+         while #queue > 0 and build() do
+         end
+         local line = 0
+         for _, page in ipairs(pages) do
+            local height = 0
+            for _, node in ipairs(page) do
+               if node.line then
+                  line = line + 1
+                  assert.is.equal(line, node.line)
+                  height = height + node.height:tonumber() + node.depth:tonumber()
+               end
+            end
+            assert.is.truthy(height <= target:tonumber())
+         end
+         assert.is.equal(60, line)
+      end)
+   end)
+end)
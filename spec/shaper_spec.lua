@@ -42,4 +42,78 @@ describe("SILE.shapers.default", function ()
       --    assert.is.truthy(measurements.height > SILE.shaper:measureChar("a").height)
       -- end)
    end)
+
+   describe("batch shaping", function ()
+      local hb = require("justenoughharfbuzz")
+
+      it("should match per-glyph shaping", function ()
+         local options = SILE.font.loadDefaults({})
+         local face = SILE.font.cache(options, SILE.shaper.getFace)
+         local expected = { hb._shape("Hello", face, options.script, options.direction, options.language,
+            face.pointsize, options.features, "") }
+         local run = hb._shape_batch({ { text = "Hello", face = face, pointsize = face.pointsize,
+            script = options.script, direction = options.direction, language = options.language,
+            features = options.features } })[1]
+         assert.is.equal(#expected, #run)
+         for i, item in ipairs(run:items()) do
+            assert.is.equal(expected[i].gid, item.gid)
+            assert.is.equal(expected[i].index, item.index)
+            assert.is.near(expected[i].width, run:width(i), 1e-9)
+            assert.is.equal(expected[i].name, run:name(i))
+            assert.is.falsy(item.name)
+         end
+      end)
+   end)
+
+   describe("paragraph shaping", function ()
+      local icu = require("justenoughicu")
+
+      it("should match token shaping and breakpoints", function ()
+         local options = SILE.font.loadDefaults({})
+         local text = "Hello world, again"
+         local segments, breakpoints = SILE.shaper:shapeParagraph(text, {
+            { start = 0, length = 5, options = options },
+            { start = 5, length = #text - 5, options = options },
+         }, { bidi = false })
+         assert.is.equal(2, #segments)
+         assert.is.equal(2, segments[2].run)
+         assert.is.equal(5, segments[2].start)
+         local expected = SILE.shaper:shapeToken("Hello", options)
+         assert.is.equal(#expected, #segments[1].items)
+         for i, item in ipairs(segments[1].items) do
+            assert.is.equal(expected[i].gid, item.gid)
+            assert.is.equal(expected[i].text, item.text)
+         end
+         assert.is.equal(" ", segments[2].items[1].text)
+         local indices, types = icu.breakpoints_packed(text, options.language)
+         assert.is.same(indices, breakpoints.indices)
+         assert.is.same(types, breakpoints.types)
+      end)
+
+      it("should shape the nodes of a paragraph together", function ()
+         local options = SILE.font.loadDefaults({})
+         local shaped = SILE.shaper:shapeTokensForNodes({
+            { text = "Shaped with ", options = options },
+            { text = "its neighbours", options = options },
+         })
+         local expected = SILE.shaper:shapeToken("its neighbours", options)
+         assert.is.equal(#expected, #shaped[2].items)
+         for i, item in ipairs(shaped[2].items) do
+            assert.is.equal(expected[i].gid, item.gid)
+            assert.is.equal(expected[i].index, item.index)
+         end
+         local indices, types = icu.breakpoints_packed("its neighbours", options.language)
+         assert.is.same(indices, shaped[2].breakpoints.indices)
+         assert.is.same(types, shaped[2].breakpoints.types)
+      end)
+
+      it("should split runs at bidi level changes", function ()
+         local options = SILE.font.loadDefaults({})
+         local text = "abc אבג def"
+         local segments = SILE.shaper:shapeParagraph(text, { { start = 0, length = #text, options = options } })
+         assert.is.equal(3, #segments)
+         assert.is.equal("RTL", segments[2].direction)
+         assert.is.equal(1, segments[2].level)
+      end)
+   end)
 end)
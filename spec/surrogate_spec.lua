@@ -16,4 +16,16 @@ describe("SILE.linebreak", function ()
       local res = icu.bidi_runs(utf8string, "LTR")
       assert.is.equal(res.length, 3)
    end)
+
+   it("should report breakpoints as byte offsets", function ()
+      local text = "a " .. utf8string .. " b"
+      local indices, types = icu.breakpoints_packed(text, "en")
+      local chunks = { icu.breakpoints(text, "en") }
+      assert.is.equal(#chunks, #indices)
+      for i = 1, #chunks do
+         assert.is.equal(chunks[i].index, indices[i])
+         assert.is.equal(chunks[i].type, types[i] == 1 and "word" or "line")
+      end
+      assert.is.equal(#text, indices[#indices])
+   end)
 end)
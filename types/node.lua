@@ -314,9 +314,10 @@ end
 -- The result is a list of nnodes inheriting the parent of the unshaped node.
 -- The notion of parent is used by the hyphenation logic and discretionaries.
 --
+-- @tparam[opt] table shaped Items and breakpoints already shaped for the text, see `shaper:shapeTokensForNodes()`.
 -- @treturn table A list of nnodes representing the shaped text.
-function unshaped:shape ()
-   local node = SILE.shaper:createNnodes(self.text, self.options)
+function unshaped:shape (shaped)
+   local node = SILE.shaper:createNnodes(self.text, self.options, shaped)
    for i = 1, #node do
       node[i].parent = self.parent
    end
@@ -0,0 +1,128 @@
+--- SILE packed length type.
+-- A packed length holds the natural size, stretch and shrink of a `length` as three plain numbers in points. It is
+-- meant for the inner loops of the line and page breakers, which accumulate thousands of node dimensions: other
+-- lengths and measurements are absolutized as they are added, and all operations work in place so that summing does
+-- not allocate. Unlike `length` it has no arithmetic metamethods; convert with `packedlength:tolength` where a regular
+-- length is needed.
+-- @types packedlength
+
+--- @type packedlength
+local packedlength = pl.class()
+packedlength.type = "packedlength"
+
+packedlength.length = 0
+packedlength.stretch = 0
+packedlength.shrink = 0
+
+-- Points in a measurement, skipping the unit lookup for the common (mutable) pt case.
+local function _pt (measurement)
+   if type(measurement) == "number" then
+      return measurement
+   end
+   return measurement._mutable and measurement.amount or measurement:tonumber()
+end
+
+--- Constructor.
+-- @tparam[opt=0] number|length|measurement|packedlength spec Initial value, absolutized, or natural size in points.
+-- @tparam[opt=0] number stretch Stretch in points, if spec is a number.
+-- @tparam[opt=0] number shrink Shrink in points, if spec is a number.
+-- @treturn packedlength
+-- @usage
+-- SILE.types.packedlength(SILE.types.length("1em plus 2pt"))
+-- SILE.types.packedlength(30, 4, 2)
+function packedlength:_init (spec, stretch, shrink)
+   if type(spec) == "table" then
+      self:set(spec)
+   else
+      self.length = spec or 0
+      self.stretch = stretch or 0
+      self.shrink = shrink or 0
+   end
+end
+
+--- Replace the value in place.
+-- @tparam number|length|measurement|packedlength other Value to copy, absolutized.
+-- @treturn packedlength self
+function packedlength:set (other)
+   if type(other) == "number" then
+      self.length, self.stretch, self.shrink = other, 0, 0
+   elseif other.type == "packedlength" then
+      self.length, self.stretch, self.shrink = other.length, other.stretch, other.shrink
+   elseif other.type == "length" then
+      self.length, self.stretch, self.shrink = _pt(other.length), _pt(other.stretch), _pt(other.shrink)
+   else
+      self.length, self.stretch, self.shrink = _pt(other), 0, 0
+   end
+   return self
+end
+
+--- Add to the value in place.
+-- @tparam number|length|measurement|packedlength other Value to add, absolutized.
+-- @treturn packedlength self
+function packedlength:add (other)
+   if type(other) == "number" then
+      self.length = self.length + other
+   elseif other.type == "packedlength" then
+      self.length = self.length + other.length
+      self.stretch = self.stretch + other.stretch
+      self.shrink = self.shrink + other.shrink
+   elseif other.type == "length" then
+      self.length = self.length + _pt(other.length)
+      self.stretch = self.stretch + _pt(other.stretch)
+      self.shrink = self.shrink + _pt(other.shrink)
+   else
+      self.length = self.length + _pt(other)
+   end
+   return self
+end
+
+--- Subtract from the value in place.
+-- @tparam number|length|measurement|packedlength other Value to subtract, absolutized.
+-- @treturn packedlength self
+function packedlength:sub (other)
+   if type(other) == "number" then
+      self.length = self.length - other
+   elseif other.type == "packedlength" then
+      self.length = self.length - other.length
+      self.stretch = self.stretch - other.stretch
+      self.shrink = self.shrink - other.shrink
+   elseif other.type == "length" then
+      self.length = self.length - _pt(other.length)
+      self.stretch = self.stretch - _pt(other.stretch)
+      self.shrink = self.shrink - _pt(other.shrink)
+   else
+      self.length = self.length - _pt(other)
+   end
+   return self
+end
+
+--- Copy the value into a new packed length.
+-- @treturn packedlength
+function packedlength:copy ()
+   return packedlength(self.length, self.stretch, self.shrink)
+end
+
+--- Convert to a regular length in points.
+-- @treturn length
+function packedlength:tolength ()
+   return SILE.types.length(self.length, self.stretch, self.shrink)
+end
+
+--- Natural size in points.
+-- @treturn number
+function packedlength:tonumber ()
+   return self.length
+end
+
+function packedlength:__tostring ()
+   local str = self.length .. "pt"
+   if self.stretch ~= 0 then
+      str = str .. " plus " .. self.stretch .. "pt"
+   end
+   if self.shrink ~= 0 then
+      str = str .. " minus " .. self.shrink .. "pt"
+   end
+   return str
+end
+
+return packedlength
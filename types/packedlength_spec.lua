@@ -0,0 +1,40 @@
+SILE = require("core.sile")
+
+describe("Packed lengths", function ()
+   it("should exist", function ()
+      assert.is.truthy(SILE.types.packedlength)
+   end)
+
+   it("should absolutize lengths and measurements", function ()
+      local packed = SILE.types.packedlength(SILE.types.length("1in plus 2pt minus 3pt"))
+      assert.is.equal(72, packed.length)
+      assert.is.equal(2, packed.stretch)
+      assert.is.equal(3, packed.shrink)
+      packed:set(SILE.types.measurement("2in"))
+      assert.is.equal(144, packed:tonumber())
+      assert.is.equal(0, packed.stretch)
+   end)
+
+   it("should add and subtract in place", function ()
+      local packed = SILE.types.packedlength(10, 1, 1)
+      local result = packed:add(SILE.types.length(5, 2, 1)):sub(SILE.types.packedlength(1, 1, 1)):add(3)
+      assert.is.equal(packed, result)
+      assert.is.equal(17, packed.length)
+      assert.is.equal(2, packed.stretch)
+      assert.is.equal(1, packed.shrink)
+   end)
+
+   it("should copy without aliasing", function ()
+      local packed = SILE.types.packedlength(10, 1, 1)
+      local copy = packed:copy()
+      copy:add(5)
+      assert.is.equal(10, packed.length)
+      assert.is.equal(15, copy.length)
+   end)
+
+   it("should convert to lengths", function ()
+      local packed = SILE.types.packedlength(10, 2, 3)
+      assert.is.equal(SILE.types.length(10, 2, 3), packed:tolength())
+      assert.is.equal("10pt plus 2pt minus 3pt", tostring(packed))
+   end)
+end)
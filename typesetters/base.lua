@@ -392,8 +392,8 @@ local speakerChangeReplacement = luautf8.char(0x2014) .. " "
 -- Special unshaped node subclass to handle space after a speaker change in dialogues
 -- introduced by an em-dash.
 local speakerChangeNode = pl.class(SILE.types.node.unshaped)
-function speakerChangeNode:shape ()
-   local node = self._base.shape(self)
+function speakerChangeNode:shape (shaped)
+   local node = self._base.shape(self, shaped)
    local spc = node[2]
    if spc and spc.is_glue then
       -- Switch the variable space glue to a fixed kern
@@ -443,40 +443,6 @@ function typesetter:breakIntoLines (nodelist, breakWidth)
    return self:breakpointsToLines(breakpoints)
 end
 
---- Extract the last shaped item from a node list.
--- @tparam table nodelist A list of nodes.
--- @treturn table The last shaped item.
--- @treturn boolean Whether the list contains a glue after the last shaped item.
--- @treturn number|nil The width of a punctuation kern after the last shaped item, if any.
-local function getLastShape (nodelist)
-   local lastShape
-   local hasGlue
-   local punctSpaceWidth
-   if nodelist then
-      -- The node list may contain nnodes, penalties, kern and glue
-      -- We skip the latter, and retrieve the last shaped item.
-      for i = #nodelist, 1, -1 do
-         local n = nodelist[i]
-         if n.is_nnode then
-            local items = n.nodes[#n.nodes].value.items
-            lastShape = items[#items]
-            break
-         end
-         if n.is_kern and n.subtype == "punctspace" then
-            -- Some languages such as French insert a special space around
-            -- punctuations.
-            -- In those case, we have different strategies for handling
-            -- italic correction.
-            punctSpaceWidth = n.width:tonumber()
-         end
-         if n.is_glue then
-            hasGlue = true
-         end
-      end
-   end
-   return lastShape, hasGlue, punctSpaceWidth
-end
-
 --- Extract the first shaped item from a node list.
 -- @tparam table nodelist A list of nodes.
 -- @treturn table The first shaped item.
@@ -575,26 +541,70 @@ local function isItalicLike (nnode)
    return font.post.italicAngle ~= 0
 end
 
+--- Shape the unshaped nodes of a list, adding italic corrections between runs.
+-- The list is processed in a single pass. Shaped nodes are left as they are and a fully shaped list is not copied, so
+-- lists that come back shaped (e.g. after a push back) cost a scan up to their first unshaped node. The last shape of
+-- each run, which the italic correction before the next one needs, is noted as the run is written out.
+-- @tparam table nodelist A list of nodes.
+-- @tparam[opt=true] boolean inplace Whether to replace the content of the list, rather than return a new one.
+-- @treturn table|nil The shaped list, if not in place.
 function typesetter:shapeAllNodes (nodelist, inplace)
    inplace = SU.boolean(inplace, true) -- Compatibility with earlier versions
-   local newNodelist = {}
-   local prec
-   local precShapedNodes
+   local count = #nodelist
+   local first = 1
+   while first <= count and not nodelist[first].is_unshaped do
+      first = first + 1
+   end
+   -- Shaping can change the number of nodes, so in place the tail is read from a copy
+   local input, from, output = nodelist, first, nodelist
+   if first <= count and inplace then
+      input, from = {}, 1
+      for i = first, count do
+         input[#input + 1] = nodelist[i]
+      end
+   elseif not inplace then
+      output = {}
+      for i = 1, first - 1 do
+         output[i] = nodelist[i]
+      end
+      if first > count then
+         return output
+      end
+   else
+      return
+   end
+   -- Shapers that can shape the whole paragraph in one go do it up front
+   local tokens = {}
+   for i = from, #input do
+      if input[i].is_unshaped then
+         tokens[#tokens + 1] = { text = input[i].text, options = input[i].options }
+      end
+   end
+   local shaped = SILE.shaper:shapeTokensForNodes(tokens) or {}
+   local token = 0
+   local written = first - 1
+   local prec, precItalic
+   local precShape, precHasGlue, precPunctSpaceWidth
    local isItalicCorrectionEnabled = SILE.settings:get("typesetter.italicCorrection")
-   for _, current in ipairs(nodelist) do
+   for i = from, #input do
+      local current = input[i]
       if current.is_unshaped then
-         local shapedNodes = current:shape()
+         token = token + 1
+         local shapedNodes = current:shape(shaped[token])
+         local italic
 
          if isItalicCorrectionEnabled and prec then
             local itCorrOffset
             local isGlue
-            if isItalicLike(prec) and not isItalicLike(current) then
-               local precShape, precHasGlue = getLastShape(precShapedNodes)
+            if precItalic == nil then
+               precItalic = isItalicLike(prec)
+            end
+            italic = isItalicLike(current)
+            if precItalic and not italic then
                local curShape, curHasGlue, curPunctSpaceWidth = getFirstShape(shapedNodes)
                isGlue = precHasGlue or curHasGlue
                itCorrOffset = fromItalicCorrection(precShape, curShape, curPunctSpaceWidth)
-            elseif not isItalicLike(prec) and isItalicLike(current) then
-               local precShape, precHasGlue, precPunctSpaceWidth = getLastShape(precShapedNodes)
+            elseif not precItalic and italic then
                local curShape, curHasGlue = getFirstShape(shapedNodes)
                isGlue = precHasGlue or curHasGlue
                itCorrOffset = toItalicCorrection(precShape, curShape, precPunctSpaceWidth)
@@ -606,34 +616,46 @@ function typesetter:shapeAllNodes (nodelist, inplace)
                -- Otherwise, the font change is considered to occur at a non-breaking
                -- point (e.g. "\em{proof}!") and the correction shall be a kern.
                local makeItCorrNode = isGlue and SILE.types.node.glue or SILE.types.node.kern
-               newNodelist[#newNodelist + 1] = makeItCorrNode({
+               written = written + 1
+               output[written] = makeItCorrNode({
                   width = SILE.types.length(itCorrOffset),
                   subtype = "itcorr",
                })
             end
          end
 
-         pl.tablex.insertvalues(newNodelist, shapedNodes)
+         -- As getFirstShape() does from the other end: the last shaped item, and
+         -- any glue or punctuation kern after it
+         precShape, precHasGlue, precPunctSpaceWidth = nil, nil, nil
+         for j = 1, #shapedNodes do
+            local n = shapedNodes[j]
+            output[written + j] = n
+            if isItalicCorrectionEnabled then
+               if n.is_nnode then
+                  local items = n.nodes[#n.nodes].value.items
+                  precShape, precHasGlue, precPunctSpaceWidth = items[#items], nil, nil
+               elseif n.is_kern and n.subtype == "punctspace" then
+                  precPunctSpaceWidth = precPunctSpaceWidth or n.width:tonumber()
+               elseif n.is_glue then
+                  precHasGlue = true
+               end
+            end
+         end
+         written = written + #shapedNodes
 
-         prec = current
-         precShapedNodes = shapedNodes
+         prec, precItalic = current, italic
       else
-         prec = nil
-         newNodelist[#newNodelist + 1] = current
+         prec, precItalic = nil, nil
+         written = written + 1
+         output[written] = current
       end
    end
 
-   if not inplace then
-      return newNodelist
-   end
-
-   for i = 1, #newNodelist do
-      nodelist[i] = newNodelist[i]
+   for i = written + 1, count do
+      output[i] = nil
    end
-   if #nodelist > #newNodelist then
-      for i = #newNodelist + 1, #nodelist do
-         nodelist[i] = nil
-      end
+   if not inplace then
+      return output
    end
 end
 
@@ -760,7 +782,7 @@ function typesetter:buildPage ()
       restart = self.frame.state.pageRestart,
    })
    if not pageNodeList then -- No break yet
-      -- self.frame.state.pageRestart = res
+      self.frame.state.pageRestart = res
       self:runHooks("noframebreak")
       return false
    end